@@ -1,4 +1,5 @@
 // Copyright [2022] <Copyright Eita Aoki (Thunder) >
+#pragma once
 #include <string>
 #include <array>
 #include <vector>
@@ -13,9 +14,10 @@
 #include <functional>
 #include <queue>
 #include <set>
+#include <type_traits>
 #pragma GCC diagnostic ignored "-Wsign-compare"
 std::random_device rnd;
-std::mt19937 mt_for_action(0);
+thread_local std::mt19937 mt_for_action(0); // スレッドごとに持つ
 
 // 時間を管理するクラス
 class TimeKeeper
@@ -43,15 +45,61 @@ public:
 constexpr const int H = 6; // 迷路の高さ
 constexpr const int W = 7; // 迷路の幅
 
-constexpr uint64_t filledBoardBits(int i) {
-    return i <= 0 ? 0 : ((filledBoardBits(i - 1) << (H + 1)) | ((1ULL << H) - 1));
+// 盤面の大きさごとのビットボード定義。1列あたり番兵を含めてH+1ビットを使う。
+// 64ビットに収まらない盤面は128ビット整数で表現する。
+template <int Height, int Width>
+struct BoardGeometry
+{
+    static constexpr int H = Height;
+    static constexpr int W = Width;
+    static constexpr int BITS = W * (H + 1);
+    static_assert(BITS <= 128, "board too large");
+
+    using Bits = typename std::conditional<(BITS <= 64), uint64_t, unsigned __int128>::type;
+
+    static constexpr Bits filledBoardBits(int i)
+    {
+        return i <= 0 ? 0 : ((filledBoardBits(i - 1) << (H + 1)) | ((Bits(1) << H) - 1));
+    }
+    static constexpr Bits possibleBoardBits(int i)
+    {
+        return i <= 0 ? 0 : ((possibleBoardBits(i - 1) << (H + 1)) | Bits(1));
+    }
+
+    // 下から数えてy % 2 == parityの行のマス
+    static constexpr Bits parityRowBits(int parity)
+    {
+        Bits bits = 0;
+        for (int y = parity; y < H; y += 2)
+            bits |= possibleBoardBits(W) << y;
+        return bits;
+    }
+
+    static constexpr Bits FILLED_BOARD_BITS = filledBoardBits(W);
+    static constexpr Bits POSSIBLE_BOARD_BITS = possibleBoardBits(W);
+    static constexpr Bits COLUMN_BITS = (Bits(1) << H) - 1;
+    static constexpr Bits ODD_ROW_BITS = parityRowBits(0);  // 1段目、3段目、…
+    static constexpr Bits EVEN_ROW_BITS = parityRowBits(1); // 2段目、4段目、…
+
+    static constexpr Bits columnBits(int x) { return COLUMN_BITS << (x * (H + 1)); }
+};
+
+inline int bitCount(uint64_t bits) { return __builtin_popcountll(bits); }
+inline int bitCount(unsigned __int128 bits)
+{
+    return __builtin_popcountll(static_cast<uint64_t>(bits)) + __builtin_popcountll(static_cast<uint64_t>(bits >> 64));
 }
-constexpr uint64_t FILLED_BOARD_BITS = filledBoardBits(W);
 
-constexpr uint64_t possibleBoardBits(int i) {
-    return i <= 0 ? 0 : ((possibleBoardBits(i - 1) << (H + 1)) | 1ULL);
+// 最下位の立っているビットの位置。bitsは0以外
+inline int lowestBitIndex(uint64_t bits) { return __builtin_ctzll(bits); }
+inline int lowestBitIndex(unsigned __int128 bits)
+{
+    uint64_t low = static_cast<uint64_t>(bits);
+    return low != 0 ? __builtin_ctzll(low) : 64 + __builtin_ctzll(static_cast<uint64_t>(bits >> 64));
 }
-constexpr uint64_t POSSIBLE_BOARD_BITS = possibleBoardBits(W);
+
+constexpr uint64_t FILLED_BOARD_BITS = BoardGeometry<H, W>::FILLED_BOARD_BITS;
+constexpr uint64_t POSSIBLE_BOARD_BITS = BoardGeometry<H, W>::POSSIBLE_BOARD_BITS;
 
 using ScoreType = int64_t;
 constexpr const ScoreType INF = 1000000000LL;
@@ -304,18 +352,25 @@ public:
     }
 };
 
-class ConnectFourStateByBitSet
+template <int BH, int BW>
+class BasicConnectFourStateByBitSet
 {
+public:
+    using Geometry = BoardGeometry<BH, BW>;
+    using Bits = typename Geometry::Bits;
+    static constexpr int H = BH;
+    static constexpr int W = BW;
+
 private:
-    uint64_t my_board_ = 0ULL;
-    uint64_t all_board_ = 0uLL;
+    Bits my_board_ = 0;
+    Bits all_board_ = 0;
     bool is_first_ = true; // 先手番であるか
     WinningStatus winning_status_ = WinningStatus::NONE;
 
-    bool isWinner(const uint64_t board)
+    static bool isWinner(const Bits board)
     {
         // 横方向の連結判定
-        uint64_t tmp_board = board & (board >> (H + 1));
+        Bits tmp_board = board & (board >> (H + 1));
         if ((tmp_board & (tmp_board >> ((H + 1) * 2))) != 0)
         {
             return true;
@@ -343,12 +398,13 @@ private:
     }
 
 public:
-    ConnectFourStateByBitSet() {}
-    ConnectFourStateByBitSet(const ConnectFourState &state) : is_first_(state.is_first_)
+    BasicConnectFourStateByBitSet() {}
+    BasicConnectFourStateByBitSet(const ConnectFourState &state) : is_first_(state.is_first_)
     {
+        static_assert(BH == ::H && BW == ::W, "ConnectFourState only supports the default board");
 
-        my_board_ = 0ULL;
-        all_board_ = 0uLL;
+        my_board_ = 0;
+        all_board_ = 0;
         for (int y = 0; y < H; y++)
         {
             for (int x = 0; x < W; x++)
@@ -356,11 +412,11 @@ public:
                 int index = x * (H + 1) + y;
                 if (state.my_board_[y][x] == 1)
                 {
-                    this->my_board_ |= 1ULL << index;
+                    this->my_board_ |= Bits(1) << index;
                 }
                 if (state.my_board_[y][x] == 1 || state.enemy_board_[y][x] == 1)
                 {
-                    this->all_board_ |= 1ULL << index;
+                    this->all_board_ |= Bits(1) << index;
                 }
             }
         }
@@ -373,9 +429,9 @@ public:
     int getCell(int x, int y) const
     {
         int index = x * (H + 1) + y;
-        if (((my_board_ >> index) & 1ULL) != 0) {
+        if (((my_board_ >> index) & 1) != 0) {
             return is_first_ ? 1 : 2;
-        } else if ((((all_board_ ^ my_board_) >> index) & 1ULL) != 0) {
+        } else if ((((all_board_ ^ my_board_) >> index) & 1) != 0) {
             return is_first_ ? 2 : 1;
         }
         return 0;
@@ -385,9 +441,9 @@ public:
     {
         this->my_board_ ^= this->all_board_; // 敵の視点に切り替える
         is_first_ = !is_first_;
-        uint64_t new_all_board = this->all_board_ | (this->all_board_ + (1ULL << (action * (H + 1))));
+        Bits new_all_board = this->all_board_ | (this->all_board_ + (Bits(1) << (action * (H + 1))));
         this->all_board_ = new_all_board;
-        constexpr uint64_t filled = FILLED_BOARD_BITS;
+        constexpr Bits filled = Geometry::FILLED_BOARD_BITS;
 
         if (isWinner(this->my_board_ ^ this->all_board_))
         {
@@ -401,8 +457,8 @@ public:
     std::vector<int> legalActions() const
     {
         std::vector<int> actions;
-        uint64_t possible = this->all_board_ + POSSIBLE_BOARD_BITS;
-        uint64_t filter = (1ULL << H) - 1;
+        Bits possible = this->all_board_ + Geometry::POSSIBLE_BOARD_BITS;
+        Bits filter = Geometry::COLUMN_BITS;
         for (int x = 0; x < W; x++)
         {
             if ((filter & possible) != 0)
@@ -429,11 +485,11 @@ public:
             {
                 int index = x * (H + 1) + y;
                 char c = '.';
-                if (((my_board_ >> index) & 1ULL) != 0)
+                if (((my_board_ >> index) & 1) != 0)
                 {
                     c = (is_first_ ? 'x' : 'o');
                 }
-                else if ((((all_board_ ^ my_board_) >> index) & 1ULL) != 0)
+                else if ((((all_board_ ^ my_board_) >> index) & 1) != 0)
                 {
                     c = (is_first_ ? 'o' : 'x');
                 }
@@ -446,8 +502,132 @@ public:
     }
 
     bool isFirst() const  { return is_first_; }
+    Bits getMyBoard() const  { return my_board_; }
+
+    // 次に石を置けるマス(各列の一番下の空き)
+    Bits possibleMoves() const
+    {
+        return (all_board_ + Geometry::POSSIBLE_BOARD_BITS) & Geometry::FILLED_BOARD_BITS;
+    }
+
+    // 手番のプレイヤー/相手が石を置けば4つ揃う空きマス(まだ置けないマスも含む)
+    Bits myWinningCells() const { return winningCells(my_board_, all_board_); }
+    Bits opponentWinningCells() const { return winningCells(my_board_ ^ all_board_, all_board_); }
+
+    // 今すぐ打てば勝てるマス
+    Bits winningMoves() const { return possibleMoves() & myWinningCells(); }
+    bool canWinNext() const { return winningMoves() != 0; }
+
+    // 次の手で相手に勝たれないマス。相手の勝ちを2か所以上防ぐ必要があれば0
+    Bits nonLosingMoves() const
+    {
+        Bits possible = possibleMoves();
+        const Bits opponent_win = opponentWinningCells();
+        const Bits forced = possible & opponent_win;
+        if (forced != 0)
+        {
+            if ((forced & (forced - 1)) != 0)
+                return 0;
+            possible = forced;
+        }
+        // 相手の勝ちマスの真下に置くと、その上に相手が置けてしまう
+        return possible & ~(opponent_win >> 1);
+    }
+
+    // 相手の次の勝ちを防ぐために打たなければならない列。自分が先に勝てる、
+    // または防ぐ必要がない場合は-1、防ぎきれない場合は-2
+    int forcedAction() const
+    {
+        if (canWinNext())
+            return -1;
+        const Bits forced = possibleMoves() & opponentWinningCells();
+        if (forced == 0)
+            return -1;
+        if ((forced & (forced - 1)) != 0)
+            return -2;
+        return cellColumn(forced);
+    }
+
+    // マスの集合に含まれる列をビットで返す
+    static uint32_t columnsOf(const Bits cells)
+    {
+        uint32_t columns = 0;
+        for (int x = 0; x < W; x++)
+        {
+            if ((cells & Geometry::columnBits(x)) != 0)
+                columns |= 1u << x;
+        }
+        return columns;
+    }
+
+    // 1マスだけのビットからその列を求める
+    static int cellColumn(const Bits cell) { return lowestBitIndex(cell) / (H + 1); }
+
+    // boardの石に1つ加えると4つ揃う空きマス
+    static Bits winningCells(const Bits board, const Bits all_board)
+    {
+        // 縦方向
+        Bits cells = (board << 1) & (board << 2) & (board << 3);
+        // 横・斜め方向
+        for (const int shift : {H + 1, H, H + 2})
+        {
+            Bits pair = (board << shift) & (board << (2 * shift));
+            cells |= pair & (board << (3 * shift));
+            cells |= pair & (board >> shift);
+            pair = (board >> shift) & (board >> (2 * shift));
+            cells |= pair & (board << shift);
+            cells |= pair & (board >> (3 * shift));
+        }
+        return cells & (Geometry::FILLED_BOARD_BITS ^ all_board);
+    }
+
+    Bits getAllBoard() const  { return all_board_; }
+
+    // 局面を一意に表す値。各列の石の上に1ビット立つ形になるので、手番は石の数から決まる
+    Bits key() const { return my_board_ + all_board_; }
+
+    // key()から局面を復元する
+    static BasicConnectFourStateByBitSet fromKey(const Bits key)
+    {
+        // 最下段のビットを足すと、各列の一番上の石のすぐ上に1ビットだけ立つ
+        const Bits marked = key + Geometry::POSSIBLE_BOARD_BITS;
+        Bits all_board = 0;
+        for (int x = 0; x < W; x++)
+        {
+            const uint64_t column = static_cast<uint64_t>(marked >> (x * (H + 1))) & ((uint64_t(1) << (H + 1)) - 1);
+            const int height = 63 - __builtin_clzll(column);
+            all_board |= ((Bits(1) << height) - 1) << (x * (H + 1));
+        }
+        return fromBoards(key - all_board, all_board, bitCount(all_board) % 2 == 0);
+    }
+
+    // ビットボードから盤面を復元する。直前の手番のプレイヤーが揃えていれば終局とみなす
+    static BasicConnectFourStateByBitSet fromBoards(Bits my_board, Bits all_board, bool is_first)
+    {
+        BasicConnectFourStateByBitSet state;
+        state.my_board_ = my_board;
+        state.all_board_ = all_board;
+        state.is_first_ = is_first;
+        if (isWinner(my_board ^ all_board))
+        {
+            state.winning_status_ = WinningStatus::LOSE;
+        }
+        else if (all_board == Geometry::FILLED_BOARD_BITS)
+        {
+            state.winning_status_ = WinningStatus::DRAW;
+        }
+        return state;
+    }
+
+    bool operator==(const BasicConnectFourStateByBitSet &other) const
+    {
+        return my_board_ == other.my_board_ && all_board_ == other.all_board_ && is_first_ == other.is_first_;
+    }
+    bool operator!=(const BasicConnectFourStateByBitSet &other) const { return !(*this == other); }
 };
 
+using ConnectFourStateByBitSet = BasicConnectFourStateByBitSet<H, W>;
+
 using State = ConnectFourState;
 
 using AIFunction = std::function<int(const State &)>;
@@ -614,15 +794,65 @@ using montecarlo::mctsActionWithTimeThreshold;
 
 namespace montecarlo_bit
 {
-    int randomActionBit(const ConnectFourStateByBitSet &state)
+    // 終盤の局面の正確な勝敗を引く表。実装はbitbase.hにある
+    class EndgameTable
+    {
+    public:
+        virtual ~EndgameTable() {}
+        // 表が持つ局面の空きマスの最大数
+        virtual int maxEmptyCells() const = 0;
+        // 表にあれば手番のプレイヤーから見た結果、なければNONEを返す
+        virtual WinningStatus probe(uint64_t key) const = 0;
+    };
+
+    // 表を引ける大きさの局面なら引いて結果を返す。引けなければNONE
+    template <class BitState>
+    WinningStatus probeEndgame(const BitState &state, const EndgameTable *table)
+    {
+        if (table == nullptr || sizeof(typename BitState::Bits) > sizeof(uint64_t) ||
+            BitState::H * BitState::W - bitCount(state.getAllBoard()) > table->maxEmptyCells())
+            return WinningStatus::NONE;
+        return table->probe(static_cast<uint64_t>(state.key()));
+    }
+
+    // 局面の価値を推定する関数。プレイアウトの代わりに使う。
+    // 盤面の大きさはBitStateの型で決まり、ほかの大きさの探索には使えない。実装はntuple.hにある
+    template <class BitState>
+    class BasicValueFunction
+    {
+    public:
+        virtual ~BasicValueFunction() {}
+        // 手番のプレイヤーの石とすべての石から、手番のプレイヤーの勝ちやすさを0〜1で返す
+        virtual double evaluate(typename BitState::Bits my_board, typename BitState::Bits all_board) const = 0;
+    };
+
+    using ValueFunction = BasicValueFunction<ConnectFourStateByBitSet>;
+
+    // 評価関数で局面の価値を推定する。次の手で決着がつく局面は評価関数を使わない
+    template <class BitState>
+    double estimateValue(const BitState &state, const BasicValueFunction<BitState> *function)
+    {
+        if (state.canWinNext())
+            return 1.;
+        if (state.nonLosingMoves() == 0)
+            return 0.;
+        return function->evaluate(state.getMyBoard(), state.getAllBoard());
+    }
+
+    template <class BitState>
+    int randomActionBit(const BitState &state)
     {
         auto legal_actions = state.legalActions();
         return legal_actions[mt_for_action() % (legal_actions.size())];
     }
     // ランダムプレイアウトをして勝敗スコアを計算する
-    double playout(ConnectFourStateByBitSet *state, double mid)
+    // playedがnullptrでなければ、各プレイヤーが石を置いたマスをplayed[isFirst()]に記録する
+    // tableがあれば、表にある局面に入った時点でその結果を使って打ち切る
+    template <class BitState>
+    double playout(BitState *state, double mid, typename BitState::Bits *played = nullptr, const EndgameTable *table = nullptr)
     { // const&にすると再帰中にディープコピーが必要になるため、高速化のためポインタにする。(constでない参照でも可)
-        switch (state->getWinningStatus())
+        const WinningStatus status = state->isDone() ? state->getWinningStatus() : probeEndgame(*state, table);
+        switch (status)
         {
         case (WinningStatus::WIN):
             return 1.;
@@ -632,8 +862,19 @@ namespace montecarlo_bit
             return 0.5;
         default:
             {
-                state->advance(randomActionBit(*state));
-                double value = 1. - playout(state, mid);
+                int action = randomActionBit(*state);
+                if (played != nullptr)
+                {
+                    auto all_board = state->getAllBoard();
+                    bool is_first = state->isFirst();
+                    state->advance(action);
+                    played[is_first] |= state->getAllBoard() ^ all_board;
+                }
+                else
+                {
+                    state->advance(action);
+                }
+                double value = 1. - playout(state, mid, played, table);
                 value = (value - mid) * 0.99 + 0.5;
                 return value;
             }
@@ -643,25 +884,351 @@ namespace montecarlo_bit
     constexpr const double C = 1.;             // UCB1の計算に使う定数
     constexpr const int EXPAND_THRESHOLD = 10; // ノードを展開する閾値
 
-    // MCTSの計算に使うノード
-    class Node
+    // 盤面を静的に評価し、手番のプレイヤーの勝ちやすさを0〜1で返す。
+    // 4つ目が空いている三連(脅威)の数、手番に有利な段の脅威、中央の列の石の数から求める
+    template <class BitState>
+    double staticEvaluation(const BitState &state)
+    {
+        using Geometry = typename BitState::Geometry;
+        switch (state.getWinningStatus())
+        {
+        case (WinningStatus::WIN):
+            return 1.;
+        case (WinningStatus::LOSE):
+            return 0.;
+        case (WinningStatus::DRAW):
+            return 0.5;
+        default:
+            break;
+        }
+        const auto all_board = state.getAllBoard();
+        const auto my_board = state.getMyBoard();
+        const auto enemy_board = all_board ^ my_board;
+        const auto playable = state.possibleMoves();
+        const auto my_threats = state.myWinningCells();
+        const auto enemy_threats = state.opponentWinningCells();
+
+        if ((my_threats & playable) != 0)
+            return 0.99; // 次の手で勝てる
+        if (bitCount(enemy_threats & playable) >= 2)
+            return 0.01; // 2か所同時には防げない
+
+        // 先手は奇数段、後手は偶数段の脅威が終盤に生きやすい
+        const auto my_rows = state.isFirst() ? Geometry::ODD_ROW_BITS : Geometry::EVEN_ROW_BITS;
+        const auto enemy_rows = state.isFirst() ? Geometry::EVEN_ROW_BITS : Geometry::ODD_ROW_BITS;
+        const auto center = Geometry::columnBits(BitState::W / 2);
+        const auto near_center = Geometry::columnBits(BitState::W / 2 - 1) | Geometry::columnBits((BitState::W + 1) / 2);
+
+        double score = 0;
+        score += 0.5 * (bitCount(my_threats) - bitCount(enemy_threats));
+        score += 1.0 * (bitCount(my_threats & my_rows) - bitCount(enemy_threats & enemy_rows));
+        score += 0.3 * (bitCount(my_board & center) - bitCount(enemy_board & center));
+        score += 0.1 * (bitCount(my_board & near_center) - bitCount(enemy_board & near_center));
+        score -= 0.5 * bitCount(enemy_threats & playable);
+        return 1. / (1. + std::exp(-score));
+    }
+
+    // 直前に置かれたマスごとに、それに応じて勝ったプレイアウトの手を覚えておく表 (Last-Good-Reply with forgetting)
+    template <class BitState>
+    class BasicReplyTable
+    {
+    private:
+        static constexpr int CELLS = BitState::Geometry::BITS;
+        int8_t reply_[2][CELLS];
+
+    public:
+        BasicReplyTable() { clear(); }
+
+        void clear() { std::fill(&reply_[0][0], &reply_[0][0] + 2 * CELLS, static_cast<int8_t>(-1)); }
+
+        // 応手の列を返す。覚えていなければ-1
+        int get(bool is_first, int prev_cell) const { return reply_[is_first][prev_cell]; }
+        void set(bool is_first, int prev_cell, int action) { reply_[is_first][prev_cell] = action; }
+        void forget(bool is_first, int prev_cell, int action)
+        {
+            if (reply_[is_first][prev_cell] == action)
+                reply_[is_first][prev_cell] = -1;
+        }
+    };
+
+    // 応手表を使ってプレイアウトし、結果に応じて表を更新する。値はplayout()と同じ。
+    // prev_cellはプレイアウト開始直前に置かれたマス(なければ-1)。プレイアウト中にメモリを確保しない
+    // tableで打ち切った場合は応手表を更新しない
+    template <class BitState>
+    double playoutWithReplies(BitState *state, double mid, BasicReplyTable<BitState> *replies, int prev_cell, typename BitState::Bits *played = nullptr,
+                              const EndgameTable *table = nullptr)
+    {
+        using Geometry = typename BitState::Geometry;
+        constexpr int H = BitState::H;
+        constexpr int W = BitState::W;
+        int cells[H * W + 1]; // cells[i]はi手目の直前に置かれたマス
+        cells[0] = prev_cell;
+        int plies = 0;
+        const bool first_mover = state->isFirst();
+        WinningStatus exact = WinningStatus::NONE;
+        while (!state->isDone())
+        {
+            exact = probeEndgame(*state, table);
+            if (exact != WinningStatus::NONE)
+                break;
+            const auto all_board = state->getAllBoard();
+            const auto possible = state->possibleMoves();
+            const bool is_first = state->isFirst();
+            int action = -1;
+            if (cells[plies] >= 0)
+            {
+                int reply = replies->get(is_first, cells[plies]);
+                if (reply >= 0 && (possible & Geometry::columnBits(reply)) != 0)
+                    action = reply;
+            }
+            if (action < 0)
+            {
+                int actions[W];
+                int count = 0;
+                for (int x = 0; x < W; x++)
+                {
+                    if ((possible & Geometry::columnBits(x)) != 0)
+                        actions[count++] = x;
+                }
+                action = actions[mt_for_action() % count];
+            }
+            state->advance(action);
+            if (played != nullptr)
+                played[is_first] |= state->getAllBoard() ^ all_board;
+            cells[++plies] = action * (H + 1) + bitCount(all_board & Geometry::columnBits(action));
+        }
+
+        double value = 0.5;
+        if (exact == WinningStatus::WIN)
+        {
+            value = 1.;
+        }
+        else if (exact == WinningStatus::LOSE)
+        {
+            value = 0.;
+        }
+        else if (state->getWinningStatus() == WinningStatus::LOSE)
+        {
+            value = 0.;
+            // 最後の手を打った側が勝者。勝者の応手を覚え、敗者の応手は忘れる
+            const bool winner_is_first = first_mover == ((plies - 1) % 2 == 0);
+            for (int i = 0; i < plies; i++)
+            {
+                if (cells[i] < 0)
+                    continue;
+                const bool mover = first_mover == (i % 2 == 0);
+                const int action = cells[i + 1] / (H + 1);
+                if (mover == winner_is_first)
+                    replies->set(mover, cells[i], action);
+                else
+                    replies->forget(mover, cells[i], action);
+            }
+        }
+        for (int i = 0; i < plies; i++)
+            value = ((1. - value) - mid) * 0.99 + 0.5;
+        return value;
+    }
+
+    // 読み切った結果を局面のキーごとに共有する表。ファイルに保存する実装はsolved_cache.hにある
+    class SolvedTable
+    {
+    public:
+        virtual ~SolvedTable() {}
+        // 保存されていればtrueを返し、手番のプレイヤーから見た結果と最善の列を書き込む
+        virtual bool lookup(uint64_t key, WinningStatus *result, int *action) = 0;
+        virtual void store(uint64_t key, WinningStatus result, int action) = 0;
+    };
+
+    // i番目に調べる列。中央に近い列から順に並べる
+    template <class BitState>
+    int solverColumn(int i)
+    {
+        return BitState::W / 2 + (i % 2 == 0 ? 1 : -1) * ((i + 1) / 2);
+    }
+
+    // 手番のプレイヤーから見た勝敗(1:勝ち、0:引き分け、-1:負け)をαβ法で求める。終局していない局面のみ
+    template <class BitState>
+    int solveNegamax(const BitState &state, int alpha, int beta, int *best_action = nullptr)
+    {
+        using Geometry = typename BitState::Geometry;
+        const auto winning = state.winningMoves();
+        if (winning != 0)
+        {
+            if (best_action != nullptr)
+                *best_action = BitState::cellColumn(winning);
+            return 1;
+        }
+        const auto moves = state.nonLosingMoves();
+        if (moves == 0)
+        {
+            if (best_action != nullptr)
+                *best_action = BitState::cellColumn(state.possibleMoves());
+            return -1;
+        }
+        int best = -2;
+        for (int i = 0; i < BitState::W; i++)
+        {
+            const int x = solverColumn<BitState>(i);
+            if ((moves & Geometry::columnBits(x)) == 0)
+                continue;
+            BitState next = state;
+            next.advance(x);
+            // 勝てる手はないので、終局するのは盤面が埋まった引き分けだけ
+            const int score = next.isDone() ? 0 : -solveNegamax(next, -beta, -alpha);
+            if (score > best)
+            {
+                best = score;
+                if (best_action != nullptr)
+                    *best_action = x;
+            }
+            alpha = std::max(alpha, score);
+            if (alpha >= beta)
+                break;
+        }
+        return best;
+    }
+
+    // 局面を読み切り、手番のプレイヤーから見た結果と最善の列を返す。
+    // tableがあれば先に引き、なければ読み切った結果を書き込む。キーが64ビットに収まる盤面でのみ使う
+    template <class BitState>
+    WinningStatus solveEndgame(const BitState &state, int *action, SolvedTable *table = nullptr)
+    {
+        const bool use_table = table != nullptr && sizeof(typename BitState::Bits) <= sizeof(uint64_t);
+        const uint64_t key = static_cast<uint64_t>(state.key());
+        WinningStatus result;
+        if (use_table && table->lookup(key, &result, action))
+            return result;
+        const int score = solveNegamax(state, -1, 1, action);
+        result = score > 0 ? WinningStatus::WIN : (score < 0 ? WinningStatus::LOSE : WinningStatus::DRAW);
+        if (use_table)
+            table->store(key, result, *action);
+        return result;
+    }
+
+    template <class BitState>
+    class BasicNodePool;
+
+    // 探索全体で共有する設定
+    template <class BitState>
+    struct BasicSearchContext
+    {
+        BasicNodePool<BitState> *pool = nullptr; // nullptrならノード数は無制限
+        double rave_equivalence = 0;             // RAVEの重みが半分になる訪問回数の目安。0ならRAVEを使わない
+        double prior_visits = 0;                 // 静的評価を初期値として何回分の訪問とみなすか
+        double prior_bias = 0;                   // 静的評価による progressive bias の重み
+
+        typename BitState::Bits rave_played_[2] = {}; // 評価中の手順で各プレイヤーが石を置いたマス
+
+        bool useRave(int for_draw) const { return rave_equivalence > 0 && for_draw == 0; }
+        bool usePrior() const { return prior_visits > 0 || prior_bias > 0; }
+
+        bool last_good_reply = false;            // 応手表を使うプレイアウトにするか
+        BasicReplyTable<BitState> replies_;      // 探索ごとに clear() する
+
+        int solve_empty_cells = 0;               // 空きマスがこれ以下の葉はプレイアウトせず読み切る。0なら読み切らない
+        SolvedTable *solved_table = nullptr;     // 読み切った結果を共有する表。nullptrなら毎回読む
+        const EndgameTable *endgame_table = nullptr; // プレイアウトが表の局面に入ったら結果を使って打ち切る
+        const BasicValueFunction<BitState> *value_function = nullptr; // 葉でプレイアウトの代わりに使う評価関数
+
+        bool shouldSolve(const BitState &state) const
+        {
+            return solve_empty_cells > 0 && BitState::H * BitState::W - bitCount(state.getAllBoard()) <= solve_empty_cells;
+        }
+
+        bool useValueFunction() const { return value_function != nullptr; }
+    };
+
+    // MCTSの計算に使うノード。盤面の大きさはBitStateの型で決まる。
+    template <class BitState>
+    class BasicNode
     {
     private:
-        ConnectFourStateByBitSet state_;
+        static_assert(BitState::W <= 16, "unexpanded_ holds one bit per column");
+
+        BitState state_;
         double w_;
+        double amaf_w_ = 0; // 親の手番のプレイヤーがこのマスに後で石を置いた時の勝ち点(RAVE)
+        double amaf_n_ = 0;
+        float prior_ = 0.5f; // 親の手番のプレイヤーから見た静的評価
+        uint16_t unexpanded_ = 0; // 展開済みで、まだ子ノードを作っていない列のビット
+        uint16_t blocked_generation_ = 0; // ノード数の上限で子ノードを作れなかった時のpoolの世代。0なら失敗していない
+        int8_t action_ = -1; // 親ノードからこのノードに至る列
+        // まだ作っていない子ノードの静的評価(このノードの手番のプレイヤーから見た値の255倍)。展開時に求める
+        uint8_t pending_priors_[BitState::W] = {};
+
+        // 親ノードからこのノードに至る手で置かれたマス。根なら-1
+        int lastCell() const
+        {
+            if (this->action_ < 0)
+                return -1;
+            const auto column = this->state_.getAllBoard() & BitState::Geometry::columnBits(this->action_);
+            return this->action_ * (BitState::H + 1) + bitCount(column) - 1;
+        }
+
+        // 子ノードを評価し、このノードの手番のプレイヤーから見た値を返す
+        double descend(BasicNode &child_node, int for_draw, double CCC, int* playout_player, BasicSearchContext<BitState> *ctx)
+        {
+            double value = 1. - child_node.evaluate(-for_draw, CCC, playout_player, ctx);
+            value = (value - 0.5) * 0.99 + 0.5;
+            if (ctx != nullptr && ctx->useRave(for_draw))
+            {
+                auto &played = ctx->rave_played_[this->state_.isFirst()];
+                played |= child_node.state_.getAllBoard() ^ this->state_.getAllBoard();
+                this->updateAmaf(played, value);
+            }
+            return value;
+        }
+
+        // ノード数の上限で子ノードを作れなかった後は、poolにノードが返るまで作り直さない
+        bool isBlocked(const BasicSearchContext<BitState> *ctx) const
+        {
+            return ctx != nullptr && ctx->pool != nullptr && this->blocked_generation_ == ctx->pool->generation();
+        }
+
+        // 評価結果を親の手番のプレイヤーから見た勝ち点として加える
+        void backup(double value, int for_draw, int playout_player)
+        {
+            if (for_draw == 0 || playout_player == this->state_.isFirst()) {
+                double pvalue = 1.0 - value;
+                if (for_draw < 0)
+                    pvalue = (pvalue > 0.5 ? 1.0 - pvalue : pvalue) * 2;
+                this->w_ += pvalue;
+                ++this->n_;
+            }
+        }
+
+        // 選ばれた子ノードの手を含め、このノードの手番のプレイヤーが以降に石を置いたマスのAMAF統計を更新する
+        void updateAmaf(typename BitState::Bits played, double value)
+        {
+            const auto all_board = this->state_.getAllBoard();
+            for (auto &child_node : this->child_nodes_)
+            {
+                if ((played & (child_node.state_.getAllBoard() ^ all_board)) != 0)
+                {
+                    child_node.amaf_w_ += value;
+                    ++child_node.amaf_n_;
+                }
+            }
+        }
 
     public:
-        std::vector<Node> child_nodes_;
+        std::vector<BasicNode> child_nodes_;
         double n_;
 
-        Node(const ConnectFourStateByBitSet &state) : state_(state), w_(0), n_(0) {}
+        BasicNode(const BitState &state) : state_(state), w_(0), n_(0) {}
 
         // ノードの評価を行う
-        double evaluate(int for_draw, double CCC, int* playout_player)
+        double evaluate(int for_draw, double CCC, int* playout_player, BasicSearchContext<BitState> *ctx = nullptr)
         {
+            const bool use_rave = ctx != nullptr && ctx->useRave(for_draw);
             double value;
+            BasicNode *child_node = nullptr;
+            if (!this->state_.isDone() && this->isExpanded())
+                child_node = this->nextChildNode(for_draw, CCC, ctx);
             if (this->state_.isDone())
             {
+                if (use_rave)
+                    ctx->rave_played_[0] = ctx->rave_played_[1] = 0;
                 switch (this->state_.getWinningStatus())
                 {
                 case (WinningStatus::WIN):
@@ -676,50 +1243,177 @@ namespace montecarlo_bit
                 }
                 *playout_player = this->state_.isFirst();
             } else
-            if (this->child_nodes_.empty())
+            if (child_node == nullptr)
             {
-                ConnectFourStateByBitSet state_copy = this->state_;
-                value = playout(&state_copy, for_draw > 0 ? 0.5 : 1.0);
-                if (this->n_ + 1 >= EXPAND_THRESHOLD)
-                    this->expand();
+                typename BitState::Bits *played = nullptr;
+                if (use_rave)
+                {
+                    played = ctx->rave_played_;
+                    played[0] = played[1] = 0;
+                }
+                if (ctx != nullptr && ctx->shouldSolve(this->state_))
+                {
+                    // 読み切れる局面はプレイアウトの代わりに正確な結果を使う
+                    int action;
+                    switch (solveEndgame(this->state_, &action, ctx->solved_table))
+                    {
+                    case (WinningStatus::WIN):
+                        value = 1.;
+                        break;
+                    case (WinningStatus::LOSE):
+                        value = 0.;
+                        break;
+                    default:
+                        value = 0.5;
+                        break;
+                    }
+                }
+                else if (ctx != nullptr && ctx->useValueFunction())
+                {
+                    value = estimateValue(this->state_, ctx->value_function);
+                }
+                else
+                {
+                    BitState state_copy = this->state_;
+                    const EndgameTable *table = ctx != nullptr ? ctx->endgame_table : nullptr;
+                    if (ctx != nullptr && ctx->last_good_reply)
+                        value = playoutWithReplies(&state_copy, for_draw > 0 ? 0.5 : 1.0, &ctx->replies_, this->lastCell(), played, table);
+                    else
+                        value = playout(&state_copy, for_draw > 0 ? 0.5 : 1.0, played, table);
+                }
+                if (!this->isExpanded() && this->n_ + 1 >= EXPAND_THRESHOLD)
+                    this->expand(ctx);
                 value = (value - 0.5) * 0.99 + 0.5;
                 *playout_player = this->state_.isFirst();
             }
             else
             {
-                value = 1. - this->nextChildNode(for_draw, CCC).evaluate(-for_draw, CCC, playout_player);
-                value = (value - 0.5) * 0.99 + 0.5;
+                value = this->descend(*child_node, for_draw, CCC, playout_player, ctx);
             }
 
-            if (for_draw == 0 || *playout_player == this->state_.isFirst()) {
-                double pvalue = 1.0 - value;
-                if (for_draw < 0)
-                    pvalue = (pvalue > 0.5 ? 1.0 - pvalue : pvalue) * 2;
-                this->w_ += pvalue;
-                ++this->n_;
-            }
+            this->backup(value, for_draw, *playout_player);
             return value;
         }
 
-        // ノードを展開する
-        void expand()
+        // 展開済みのノードで、選ぶ子ノードを指定して評価する。根での行動の選び方を変える時に使う
+        double evaluateChild(int index, int for_draw, double CCC, int* playout_player, BasicSearchContext<BitState> *ctx = nullptr)
+        {
+            double value = this->descend(this->child_nodes_[index], for_draw, CCC, playout_player, ctx);
+            this->backup(value, for_draw, *playout_player);
+            return value;
+        }
+
+        // ノードを展開する。子ノードはまだ作らず、選ばれた時にexpandAction()で作る。
+        // ノード数の上限に達している場合は展開しない
+        void expand(const BasicSearchContext<BitState> *ctx = nullptr)
         {
-            auto legal_actions = this->state_.legalActions();
             this->child_nodes_.clear();
-            for (const auto action : legal_actions)
+            this->unexpanded_ = 0;
+            if (ctx != nullptr && ctx->pool != nullptr)
             {
-                this->child_nodes_.emplace_back(this->state_);
-                this->child_nodes_.back().state_.advance(action);
+                if (this->isBlocked(ctx))
+                    return;
+                if (ctx->pool->isFull())
+                {
+                    this->blocked_generation_ = ctx->pool->generation();
+                    return;
+                }
+            }
+            this->unexpanded_ = static_cast<uint16_t>(BitState::columnsOf(this->state_.possibleMoves()));
+            const bool use_prior = ctx != nullptr && ctx->usePrior();
+            for (int x = 0; x < BitState::W; x++)
+            {
+                double prior = 0.5;
+                if (use_prior && (this->unexpanded_ & (1u << x)) != 0)
+                {
+                    BitState next = this->state_;
+                    next.advance(x);
+                    prior = 1. - staticEvaluation(next);
+                }
+                this->pending_priors_[x] = static_cast<uint8_t>(prior * 255. + 0.5);
             }
         }
 
-        // どのノードを評価するか選択する
-        Node &nextChildNode(int for_draw, double CCC)
+        double pendingPrior(int action) const { return this->pending_priors_[action] / 255.; }
+
+        // 列actionの子ノードを列の順を保って作る。ノード数の上限に達していればnullptrを返す。
+        // 子ノードの配列は作る時に2, 4, …, Wと伸ばし、poolには確保した分を数える。
+        // 配列を伸ばすと子ノードの位置が変わる
+        BasicNode *expandAction(int action, const BasicSearchContext<BitState> *ctx = nullptr)
         {
-            for (auto &child_node : this->child_nodes_)
+            assert((this->unexpanded_ & (1u << action)) != 0);
+            if (ctx != nullptr && ctx->pool != nullptr && this->isBlocked(ctx))
+                return nullptr;
+            const size_t capacity = this->child_nodes_.capacity();
+            if (this->child_nodes_.size() == capacity)
             {
-                if (child_node.n_ == 0)
-                    return child_node;
+                const size_t grown = std::min<size_t>(BitState::W, std::max<size_t>(2, capacity * 2));
+                if (ctx != nullptr && ctx->pool != nullptr && !ctx->pool->allocate(grown - capacity))
+                {
+                    this->blocked_generation_ = ctx->pool->generation();
+                    return nullptr;
+                }
+                this->child_nodes_.reserve(grown);
+            }
+            this->unexpanded_ &= ~(1u << action);
+            auto it = this->child_nodes_.begin();
+            while (it != this->child_nodes_.end() && it->action_ < action)
+                ++it;
+            it = this->child_nodes_.emplace(it, this->state_);
+            it->state_.advance(action);
+            it->action_ = action;
+            it->prior_ = static_cast<float>(this->pendingPrior(action));
+            return &*it;
+        }
+
+        // まだ作っていない子ノードをすべて作る。ノード数の上限に達したらそこでやめる
+        void expandAll(const BasicSearchContext<BitState> *ctx = nullptr)
+        {
+            while (this->unexpanded_ != 0)
+            {
+                if (this->expandAction(__builtin_ctz(this->unexpanded_), ctx) == nullptr)
+                    return;
+            }
+        }
+
+        bool isExpanded() const { return !this->child_nodes_.empty() || this->unexpanded_ != 0; }
+        uint32_t getUnexpanded() const { return this->unexpanded_; }
+
+        // 子ノードを子孫ごとpoolに返して葉に戻す
+        void releaseChildren(BasicNodePool<BitState> *pool)
+        {
+            pool->release(&this->child_nodes_);
+            this->unexpanded_ = 0;
+        }
+
+        // どのノードを評価するか選択する。まだ作っていない子ノードは選ばれた時に作る
+        // RAVEを使う場合は、訪問回数が増えるにつれて重みが減るようにAMAFの勝率を混ぜる。
+        // 静的評価を使う場合は未訪問の子ノードも評価の高い順に選ぶ。
+        // ノード数の上限で子ノードを作れず、選べる子ノードがなければnullptrを返す
+        BasicNode *nextChildNode(int for_draw, double CCC, const BasicSearchContext<BitState> *ctx = nullptr)
+        {
+            const bool use_rave = ctx != nullptr && ctx->useRave(for_draw);
+            const bool use_prior = ctx != nullptr && ctx->usePrior();
+            if (!use_prior)
+            {
+                // 未訪問の列を左から順に選ぶ
+                BasicNode *unvisited = nullptr;
+                for (auto &child_node : this->child_nodes_)
+                {
+                    if (child_node.n_ == 0)
+                    {
+                        unvisited = &child_node;
+                        break;
+                    }
+                }
+                if (this->unexpanded_ != 0 && (unvisited == nullptr || __builtin_ctz(this->unexpanded_) < unvisited->action_))
+                {
+                    BasicNode *child_node = this->expandAction(__builtin_ctz(this->unexpanded_), ctx);
+                    if (child_node != nullptr)
+                        return child_node;
+                }
+                if (unvisited != nullptr)
+                    return unvisited;
             }
             double t = 0;
             for (const auto &child_node : this->child_nodes_)
@@ -731,26 +1425,270 @@ namespace montecarlo_bit
             for (int i = 0; i < this->child_nodes_.size(); i++)
             {
                 const auto &child_node = this->child_nodes_[i];
-                double value = child_node.w_ / child_node.n_;
-                double ucb1_value = value + (double)CCC * std::sqrt(2. * std::log(t) / child_node.n_);
+                double value;
+                double n = child_node.n_;
+                if (use_prior)
+                {
+                    double visits = n + ctx->prior_visits;
+                    value = visits > 0 ? (child_node.w_ + child_node.prior_ * ctx->prior_visits) / visits : child_node.prior_;
+                }
+                else
+                {
+                    value = child_node.w_ / n;
+                }
+                if (use_rave && child_node.amaf_n_ > 0)
+                {
+                    double beta = std::sqrt(ctx->rave_equivalence / (3 * n + ctx->rave_equivalence));
+                    value = (1 - beta) * value + beta * child_node.amaf_w_ / child_node.amaf_n_;
+                }
+                double ucb1_value;
+                if (use_prior)
+                {
+                    ucb1_value = value + (double)CCC * std::sqrt(2. * std::log(t + 1) / (n + 1)) + ctx->prior_bias * child_node.prior_ / (n + 1);
+                }
+                else
+                {
+                    ucb1_value = value + (double)CCC * std::sqrt(2. * std::log(t) / n);
+                }
                 if (ucb1_value > best_value)
                 {
                     best_action_index = i;
                     best_value = ucb1_value;
                 }
             }
-            return this->child_nodes_[best_action_index];
+            if (use_prior && this->unexpanded_ != 0)
+            {
+                // まだ作っていない子ノードは未訪問なので、値は静的評価そのものになる
+                const double exploration = (double)CCC * std::sqrt(2. * std::log(t + 1));
+                int best_pending = -1;
+                for (int x = 0; x < BitState::W; x++)
+                {
+                    if ((this->unexpanded_ & (1u << x)) == 0)
+                        continue;
+                    const double prior = this->pendingPrior(x);
+                    const double ucb1_value = prior + exploration + ctx->prior_bias * prior;
+                    if (ucb1_value > best_value)
+                    {
+                        best_pending = x;
+                        best_value = ucb1_value;
+                    }
+                }
+                if (best_pending >= 0)
+                {
+                    BasicNode *child_node = this->expandAction(best_pending, ctx);
+                    if (child_node != nullptr)
+                        return child_node;
+                }
+            }
+            return best_action_index >= 0 ? &this->child_nodes_[best_action_index] : nullptr;
         }
 
-        const ConnectFourStateByBitSet& getState() const  { return state_; }
+        const BitState& getState() const  { return state_; }
         double getW() const { return w_; }
+        int getAction() const { return action_; }
+        void setStats(double w, double n)
+        {
+            this->w_ = w;
+            this->n_ = n;
+        }
+    };
+
+    // 探索木のノード数に上限を設け、訪問回数の少ない部分木を葉に戻す。
+    // ノード数は子ノードの配列に確保した枠の数で数えるので、上限はそのままメモリ量の上限になる
+    template <class BitState>
+    class BasicNodePool
+    {
+    public:
+        using Node = BasicNode<BitState>;
+        using Children = std::vector<Node>;
+
+    private:
+        size_t max_nodes_;
+        size_t node_count_ = 0;
+        uint16_t generation_ = 1; // ノードが返却されるたびに進める。0は使わない
+
+        static size_t subtreeSize(const Node &node)
+        {
+            size_t size = node.child_nodes_.capacity();
+            for (const auto &child : node.child_nodes_)
+                size += subtreeSize(child);
+            return size;
+        }
+
+        static double maxVisits(const Node &node)
+        {
+            double n = node.n_;
+            for (const auto &child : node.child_nodes_)
+                n = std::max(n, maxVisits(child));
+            return n;
+        }
+
+        // 訪問回数がthreshold未満の部分木を畳んだ場合に解放されるノード数
+        static size_t countRemovable(const Node &node, double threshold)
+        {
+            size_t count = 0;
+            for (const auto &child : node.child_nodes_)
+            {
+                if (child.child_nodes_.empty())
+                    continue;
+                if (child.n_ < threshold)
+                    count += subtreeSize(child);
+                else
+                    count += countRemovable(child, threshold);
+            }
+            return count;
+        }
+
+        void collapse(Node &node, double threshold)
+        {
+            for (auto &child : node.child_nodes_)
+            {
+                if (child.child_nodes_.empty())
+                    continue;
+                if (child.n_ < threshold)
+                    child.releaseChildren(this);
+                else
+                    collapse(child, threshold);
+            }
+        }
+
+    public:
+        // 根ノード以外に保持できるノード数を指定する
+        explicit BasicNodePool(size_t max_nodes) : max_nodes_(std::max<size_t>(max_nodes, BitState::W)) {}
+
+        // メモリ量(バイト)からノード数の上限を求める
+        static constexpr size_t nodesForBytes(size_t bytes) { return bytes / sizeof(Node); }
+
+        size_t size() const { return node_count_; }
+        size_t capacity() const { return max_nodes_; }
+        uint16_t generation() const { return generation_; }
+        bool isFull() const { return node_count_ + BitState::W > max_nodes_; }
+
+        // 子ノードの配列をcount個分伸ばす分を数える。上限を超える場合はfalseを返す
+        bool allocate(size_t count)
+        {
+            if (node_count_ + count > max_nodes_)
+                return false;
+            node_count_ += count;
+            return true;
+        }
+
+        // 子ノード配列を子孫ごと解放する
+        void release(Children *children)
+        {
+            for (auto &child : *children)
+            {
+                if (child.child_nodes_.capacity() != 0)
+                    this->release(&child.child_nodes_);
+            }
+            node_count_ -= children->capacity();
+            if (children->capacity() != 0 && ++generation_ == 0)
+                generation_ = 1;
+            Children().swap(*children);
+        }
+
+        // 上限に達していたら訪問回数の少ない部分木から葉に戻し、ノード数を上限の3/4以下にする
+        void trimIfNeeded(Node &root)
+        {
+            if (!this->isFull())
+                return;
+            size_t target = max_nodes_ / 4 * 3;
+            if (node_count_ <= target)
+                return;
+            size_t excess = node_count_ - target;
+
+            double lo = 0;
+            double hi = maxVisits(root) + 1;
+            while (lo + 1 < hi)
+            {
+                double mid = std::floor((lo + hi) / 2);
+                if (countRemovable(root, mid) >= excess)
+                    hi = mid;
+                else
+                    lo = mid;
+            }
+            collapse(root, hi);
+        }
     };
 
+    using Node = BasicNode<ConnectFourStateByBitSet>;
+    using NodePool = BasicNodePool<ConnectFourStateByBitSet>;
+    using SearchContext = BasicSearchContext<ConnectFourStateByBitSet>;
+
+    // 最も多く訪問された子ノードの列を返す
+    template <class BitState>
+    int bestActionByVisits(const BasicNode<BitState> &root_node)
+    {
+        int best_action_searched_number = -1;
+        int best_action = -1;
+        for (const auto &child_node : root_node.child_nodes_)
+        {
+            int n = child_node.n_;
+            if (n > best_action_searched_number)
+            {
+                best_action = child_node.getAction();
+                best_action_searched_number = n;
+            }
+        }
+        return best_action;
+    }
+
+    // 根での行動の選び方
+    enum class RootPolicy
+    {
+        UCB,                // 根も含めてUCB1で選び、最も訪問された列にする
+        SEQUENTIAL_HALVING, // 根は逐次半減法、根より下はUCB1で選ぶ。反復回数が決まっている時のみ
+    };
+
+    // 逐次半減法で根の行動を選ぶ。iterations回の評価をラウンドに分け、各ラウンドで残った列を
+    // 同じ回数ずつ評価して勝率の高い半分を残す。根は展開済みであること
+    template <class BitState>
+    int sequentialHalving(BasicNode<BitState> &root_node, const int64_t iterations, int for_draw, double CCC, BasicSearchContext<BitState> *ctx = nullptr)
+    {
+        root_node.expandAll(ctx);
+        const auto &children = root_node.child_nodes_;
+        std::vector<int> candidates;
+        for (int i = 0; i < children.size(); i++)
+            candidates.emplace_back(i);
+        if (candidates.empty())
+            return -1;
+        int rounds = 0;
+        while ((size_t(1) << rounds) < candidates.size())
+            rounds++;
+        auto mean = [&children](int i)
+        {
+            return children[i].n_ > 0 ? children[i].getW() / children[i].n_ : 0.;
+        };
+        int64_t remaining = iterations;
+        for (int round = 0; candidates.size() > 1; round++)
+        {
+            const int64_t visits = std::max<int64_t>(1, remaining / (rounds - round) / candidates.size());
+            for (int64_t v = 0; v < visits; v++)
+            {
+                for (const int i : candidates)
+                {
+                    int playout_player = -1;
+                    root_node.evaluateChild(i, for_draw, CCC, &playout_player, ctx);
+                    if (ctx != nullptr && ctx->pool != nullptr)
+                        ctx->pool->trimIfNeeded(root_node);
+                    --remaining;
+                }
+            }
+            std::stable_sort(candidates.begin(), candidates.end(), [&mean](int a, int b)
+                             { return mean(a) > mean(b); });
+            candidates.resize((candidates.size() + 1) / 2);
+        }
+        return children[candidates[0]].getAction();
+    }
+
     // 制限時間(ms)を指定してMCTSで行動を決定する
-    int mctsActionBitWithTimeThreshold(const State &state, const int64_t time_threshold, int for_draw, double CCC)
+    template <class BitState>
+    int mctsActionBitWithTimeThreshold(const BitState &state, const int64_t time_threshold, int for_draw, double CCC, BasicSearchContext<BitState> *ctx = nullptr)
     {
-        Node root_node = Node(ConnectFourStateByBitSet(state));
-        root_node.expand();
+        BasicNode<BitState> root_node = BasicNode<BitState>(state);
+        root_node.expand(ctx);
+        if (ctx != nullptr)
+            ctx->replies_.clear();
         auto time_keeper = TimeKeeper(time_threshold);
         int cnt;
         for (cnt = 0;; cnt++)
@@ -760,23 +1698,49 @@ namespace montecarlo_bit
                 break;
             }
             int playout_player = -1;
-            root_node.evaluate(for_draw, CCC, &playout_player);
+            root_node.evaluate(for_draw, CCC, &playout_player, ctx);
+            if (ctx != nullptr && ctx->pool != nullptr)
+                ctx->pool->trimIfNeeded(root_node);
         }
-        auto legal_actions = state.legalActions();
+        int action = bestActionByVisits(root_node);
+        if (ctx != nullptr && ctx->pool != nullptr)
+            ctx->pool->release(&root_node.child_nodes_);
+        return action;
+    }
 
-        int best_action_searched_number = -1;
-        int best_action_index = -1;
-        assert(legal_actions.size() == root_node.child_nodes_.size());
-        for (int i = 0; i < legal_actions.size(); i++)
+    // 反復回数を指定してMCTSで行動を決定する
+    template <class BitState>
+    int mctsActionBitWithIterations(const BitState &state, const int64_t iterations, int for_draw, double CCC, BasicSearchContext<BitState> *ctx = nullptr,
+                                    RootPolicy policy = RootPolicy::UCB)
+    {
+        BasicNode<BitState> root_node = BasicNode<BitState>(state);
+        root_node.expand(ctx);
+        if (ctx != nullptr)
+            ctx->replies_.clear();
+        int action;
+        if (policy == RootPolicy::SEQUENTIAL_HALVING)
         {
-            int n = root_node.child_nodes_[i].n_;
-            if (n > best_action_searched_number)
+            action = sequentialHalving(root_node, iterations, for_draw, CCC, ctx);
+        }
+        else
+        {
+            for (int64_t cnt = 0; cnt < iterations; cnt++)
             {
-                best_action_index = i;
-                best_action_searched_number = n;
+                int playout_player = -1;
+                root_node.evaluate(for_draw, CCC, &playout_player, ctx);
+                if (ctx != nullptr && ctx->pool != nullptr)
+                    ctx->pool->trimIfNeeded(root_node);
             }
+            action = bestActionByVisits(root_node);
         }
-        return legal_actions[best_action_index];
+        if (ctx != nullptr && ctx->pool != nullptr)
+            ctx->pool->release(&root_node.child_nodes_);
+        return action;
+    }
+
+    int mctsActionBitWithTimeThreshold(const State &state, const int64_t time_threshold, int for_draw, double CCC)
+    {
+        return mctsActionBitWithTimeThreshold(ConnectFourStateByBitSet(state), time_threshold, for_draw, CCC);
     }
 }
 using montecarlo_bit::mctsActionBitWithTimeThreshold;
@@ -0,0 +1,273 @@
+// Analyzes many positions in parallel and prints one JSON line per position.
+//
+// Each input line is a move sequence ("4453", 1-based columns) or board rows
+// from top to bottom separated by '/' ("......./.../...x..."). Empty lines and
+// lines starting with '#' are skipped. Results are printed as soon as they are
+// ready, so they may come out of input order; "line" tells which input it was.
+#include "02_BitBoard.h"
+#include "bitbase.h"
+#include "ntuple.h"
+#include "position.h"
+#include "solved_cache.h"
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <string.h>
+
+using namespace montecarlo_bit;
+using namespace std;
+
+struct Options {
+    int64_t iterations = 100000;  // per position
+    int64_t time_threshold = 0;   // ms per position, 0 for no limit
+    int threads = 0;              // 0 for all cores
+    size_t max_nodes = 1 << 20;   // per thread
+    bool for_draw = false;
+    double prior_visits = 0;
+    double rave_equivalence = 0;
+    int solve_empty_cells = 0;
+    bool sequential_halving = false;  // needs a fixed iteration count
+    const char* cache_path = nullptr;
+    uint64_t cache_entries = 1 << 22;
+    const char* bitbase_path = nullptr;
+    const char* value_path = nullptr;
+};
+
+struct Job {
+    size_t line_no;
+    string text;
+};
+
+// Hands out input lines to worker threads and serializes their output.
+class JobQueue {
+private:
+    istream& is_;
+    size_t line_no_ = 0;
+    mutex in_mutex_;
+    mutex out_mutex_;
+
+public:
+    explicit JobQueue(istream& is) : is_(is) {}
+
+    bool next(Job* job) {
+        lock_guard<mutex> lock(in_mutex_);
+        string line;
+        while (getline(is_, line)) {
+            ++line_no_;
+            while (!line.empty() && (line.back() == '\r' || line.back() == ' ' || line.back() == '\t'))
+                line.pop_back();
+            size_t start = line.find_first_not_of(" \t");
+            if (start == string::npos || line[start] == '#')
+                continue;
+            job->line_no = line_no_;
+            job->text = line.substr(start);
+            return true;
+        }
+        return false;
+    }
+
+    void print(const string& s) {
+        lock_guard<mutex> lock(out_mutex_);
+        cout << s << '\n' << flush;
+    }
+};
+
+static string jsonEscape(const string& s) {
+    string result;
+    for (const char c : s) {
+        if (c == '"' || c == '\\') {
+            result += '\\';
+            result += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            result += buf;
+        } else {
+            result += c;
+        }
+    }
+    return result;
+}
+
+static string analyze(const Job& job, const Options& options, SearchContext* ctx) {
+    ostringstream os;
+    os << "{\"line\":" << job.line_no << ",\"position\":\"" << jsonEscape(job.text) << "\"";
+
+    ConnectFourStateByBitSet state;
+    if (!parsePosition(job.text, &state)) {
+        os << ",\"error\":\"invalid position\"}";
+        return os.str();
+    }
+    if (state.isDone()) {
+        os << ",\"error\":\"game is over\"}";
+        return os.str();
+    }
+
+    int for_draw = options.for_draw ? 1 : 0;
+    double CCC = options.for_draw ? 3 : 1;
+    auto start = chrono::high_resolution_clock::now();
+    TimeKeeper time_keeper(options.time_threshold);
+    Node root_node(state);
+    root_node.expand(ctx);
+    int64_t count = 0;
+    int best;
+    if (options.sequential_halving) {
+        best = sequentialHalving(root_node, options.iterations, for_draw, CCC, ctx);
+        count = options.iterations;
+    } else {
+        while (count < options.iterations) {
+            if (options.time_threshold > 0 && (count & 63) == 0 && time_keeper.isTimeOver())
+                break;
+            int playout_player = -1;
+            root_node.evaluate(for_draw, CCC, &playout_player, ctx);
+            ctx->pool->trimIfNeeded(root_node);
+            ++count;
+        }
+        best = bestActionByVisits(root_node);
+    }
+    auto elapsed = chrono::duration_cast<chrono::milliseconds>(chrono::high_resolution_clock::now() - start).count();
+
+    vector<int> visits(W, 0);
+    double value = 0.5;
+    for (const auto& child : root_node.child_nodes_) {
+        visits[child.getAction()] = static_cast<int>(child.n_);
+        if (child.getAction() == best && child.n_ > 0)
+            value = child.getW() / child.n_;
+    }
+    ctx->pool->release(&root_node.child_nodes_);
+
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.4f", value);
+    os << ",\"best\":" << best + 1 << ",\"value\":" << buf << ",\"visits\":[";
+    for (int x = 0; x < W; ++x)
+        os << (x > 0 ? "," : "") << visits[x];
+    os << "],\"iterations\":" << count << ",\"ms\":" << elapsed << "}";
+    return os.str();
+}
+
+static void worker(int index, JobQueue* queue, const Options* options, SolvedCache* cache, const Bitbase* bitbase, const NTupleNetwork* network) {
+    // Every thread's generator starts from the same seed; give each its own
+    // so the threads do not play the same playouts.
+    mt_for_action.seed(index);
+    NodePool pool(options->max_nodes);
+    SearchContext ctx;
+    ctx.pool = &pool;
+    ctx.prior_visits = options->prior_visits;
+    ctx.prior_bias = options->prior_visits > 0 ? 1.0 : 0.0;
+    ctx.rave_equivalence = options->rave_equivalence;
+    ctx.solve_empty_cells = options->solve_empty_cells;
+    if (cache->isOpen())
+        ctx.solved_table = cache;
+    if (bitbase->size() > 0)
+        ctx.endgame_table = bitbase;
+    if (!network->empty())
+        ctx.value_function = network;
+    Job job;
+    while (queue->next(&job))
+        queue->print(analyze(job, *options, &ctx));
+}
+
+static void usage() {
+    cerr << "Usage: analyze [options] [file]\n"
+         << "  -n N      iterations per position (default 100000)\n"
+         << "  -t MS     time limit per position in ms (default none)\n"
+         << "  -j N      worker threads (default: number of cores)\n"
+         << "  -m N      max tree nodes per thread (default 1048576)\n"
+         << "  -d        search for draw\n"
+         << "  --prior V use the static evaluation prior with V virtual visits\n"
+         << "  --rave K  use RAVE with equivalence K\n"
+         << "  --solve N solve leaves with at most N empty cells exactly\n"
+         << "  --halving use sequential halving at the root (ignores -t)\n"
+         << "  --cache F share solved positions through the cache file F\n"
+         << "            (created with 4194304 entries if missing)\n"
+         << "  --bitbase F  end playouts in positions found in the bitbase file F\n"
+         << "  --value F    evaluate leaves with the n-tuple weight file F instead of playouts\n"
+         << "Reads positions from file or stdin. Output columns are 1-based;\n"
+         << "visits[i] is for column i+1.\n";
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    const char* path = nullptr;
+    bool has_iterations = false;
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (strcmp(arg, "-n") == 0 && has_value) {
+            options.iterations = atoll(argv[++i]);
+            has_iterations = true;
+        } else if (strcmp(arg, "-t") == 0 && has_value) {
+            options.time_threshold = atoll(argv[++i]);
+        } else if (strcmp(arg, "-j") == 0 && has_value) {
+            options.threads = atoi(argv[++i]);
+        } else if (strcmp(arg, "-m") == 0 && has_value) {
+            options.max_nodes = atoll(argv[++i]);
+        } else if (strcmp(arg, "-d") == 0) {
+            options.for_draw = true;
+        } else if (strcmp(arg, "--prior") == 0 && has_value) {
+            options.prior_visits = atof(argv[++i]);
+        } else if (strcmp(arg, "--rave") == 0 && has_value) {
+            options.rave_equivalence = atof(argv[++i]);
+        } else if (strcmp(arg, "--solve") == 0 && has_value) {
+            options.solve_empty_cells = atoi(argv[++i]);
+        } else if (strcmp(arg, "--halving") == 0) {
+            options.sequential_halving = true;
+        } else if (strcmp(arg, "--cache") == 0 && has_value) {
+            options.cache_path = argv[++i];
+        } else if (strcmp(arg, "--bitbase") == 0 && has_value) {
+            options.bitbase_path = argv[++i];
+        } else if (strcmp(arg, "--value") == 0 && has_value) {
+            options.value_path = argv[++i];
+        } else if (arg[0] != '-' && path == nullptr) {
+            path = arg;
+        } else {
+            usage();
+            return 1;
+        }
+    }
+    // -t alone searches until the time limit; with -n, whichever ends first.
+    if (options.time_threshold > 0 && !has_iterations)
+        options.iterations = INT64_MAX;
+    if (options.sequential_halving && options.iterations == INT64_MAX) {
+        cerr << "--halving needs -n" << endl;
+        return 1;
+    }
+    if (options.threads <= 0)
+        options.threads = max(1u, thread::hardware_concurrency());
+
+    ifstream ifs;
+    if (path != nullptr) {
+        ifs.open(path);
+        if (!ifs) {
+            cerr << "Cannot open: " << path << endl;
+            return 1;
+        }
+    }
+    JobQueue queue(path != nullptr ? static_cast<istream&>(ifs) : cin);
+
+    SolvedCache cache;
+    if (options.cache_path != nullptr && !cache.open(options.cache_path, options.cache_entries)) {
+        cerr << "Cannot open cache: " << options.cache_path << endl;
+        return 1;
+    }
+
+    Bitbase bitbase;
+    if (options.bitbase_path != nullptr && !bitbase.load(options.bitbase_path)) {
+        cerr << "Cannot load bitbase: " << options.bitbase_path << endl;
+        return 1;
+    }
+
+    NTupleNetwork network;
+    if (options.value_path != nullptr && !network.load(options.value_path)) {
+        cerr << "Cannot load weights: " << options.value_path << endl;
+        return 1;
+    }
+
+    vector<thread> threads;
+    for (int i = 0; i < options.threads; ++i)
+        threads.emplace_back(worker, i, &queue, &options, &cache, &bitbase, &network);
+    for (auto& t : threads)
+        t.join();
+    return 0;
+}
@@ -0,0 +1,121 @@
+// Plays MCTS variants against the plain MCTS at a fixed iteration budget
+// and prints the win rate of the variant.
+#include "02_BitBoard.h"
+#include "ntuple.h"
+#include <iostream>
+#include <string.h>
+
+using namespace montecarlo_bit;
+using namespace std;
+
+static AIFunction plainAi(int64_t iterations) {
+    return [iterations](const State& state) {
+        return mctsActionBitWithIterations(ConnectFourStateByBitSet(state), iterations, 0, C);
+    };
+}
+
+static AIFunction raveAi(int64_t iterations, double equivalence) {
+    return [iterations, equivalence](const State& state) {
+        SearchContext ctx;
+        ctx.rave_equivalence = equivalence;
+        return mctsActionBitWithIterations(ConnectFourStateByBitSet(state), iterations, 0, C, &ctx);
+    };
+}
+
+static AIFunction priorAi(int64_t iterations, double visits, double bias) {
+    return [iterations, visits, bias](const State& state) {
+        SearchContext ctx;
+        ctx.prior_visits = visits;
+        ctx.prior_bias = bias;
+        return mctsActionBitWithIterations(ConnectFourStateByBitSet(state), iterations, 0, C, &ctx);
+    };
+}
+
+static AIFunction lgrAi(int64_t iterations) {
+    return [iterations](const State& state) {
+        SearchContext ctx;
+        ctx.last_good_reply = true;
+        return mctsActionBitWithIterations(ConnectFourStateByBitSet(state), iterations, 0, C, &ctx);
+    };
+}
+
+static AIFunction solveAi(int64_t iterations, int empty_cells) {
+    return [iterations, empty_cells](const State& state) {
+        SearchContext ctx;
+        ctx.solve_empty_cells = empty_cells;
+        return mctsActionBitWithIterations(ConnectFourStateByBitSet(state), iterations, 0, C, &ctx);
+    };
+}
+
+static AIFunction halvingAi(int64_t iterations) {
+    return [iterations](const State& state) {
+        SearchContext ctx;
+        return mctsActionBitWithIterations(ConnectFourStateByBitSet(state), iterations, 0, C, &ctx, RootPolicy::SEQUENTIAL_HALVING);
+    };
+}
+
+static AIFunction valueAi(int64_t iterations, const NTupleNetwork* network) {
+    return [iterations, network](const State& state) {
+        SearchContext ctx;
+        ctx.value_function = network;
+        return mctsActionBitWithIterations(ConnectFourStateByBitSet(state), iterations, 0, C, &ctx);
+    };
+}
+
+static void usage() {
+    cerr << "Usage: bench <mode> [iterations] [games] [param]\n"
+         << "  rave    RAVE (param: equivalence, default 100) vs plain MCTS\n"
+         << "  prior   static evaluation prior (param: prior visits, default 20) vs plain MCTS\n"
+         << "  lgr     last-good-reply playouts vs plain MCTS\n"
+         << "  solve   endgame solving at leaves (param: empty cells, default 12) vs plain MCTS\n"
+         << "  halving sequential halving at the root vs plain MCTS\n"
+         << "  value   n-tuple network at the leaves (param: weight file from ntrain) vs plain MCTS\n";
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        usage();
+        return 1;
+    }
+    const char* mode = argv[1];
+    int64_t iterations = argc > 2 ? atoll(argv[2]) : 10000;
+    int games = argc > 3 ? atoi(argv[3]) : 50;
+    const char* param = argc > 4 ? argv[4] : nullptr;
+
+    AIFunction variant;
+    string name;
+    NTupleNetwork network;
+    if (strcmp(mode, "rave") == 0) {
+        double equivalence = param != nullptr ? atof(param) : 100;
+        variant = raveAi(iterations, equivalence);
+        name = "rave(" + to_string((int)equivalence) + ")";
+    } else if (strcmp(mode, "prior") == 0) {
+        double visits = param != nullptr ? atof(param) : 20;
+        variant = priorAi(iterations, visits, 1.0);
+        name = "prior(" + to_string((int)visits) + ")";
+    } else if (strcmp(mode, "lgr") == 0) {
+        variant = lgrAi(iterations);
+        name = "lgr";
+    } else if (strcmp(mode, "solve") == 0) {
+        int empty_cells = param != nullptr ? atoi(param) : 12;
+        variant = solveAi(iterations, empty_cells);
+        name = "solve(" + to_string(empty_cells) + ")";
+    } else if (strcmp(mode, "halving") == 0) {
+        variant = halvingAi(iterations);
+        name = "halving";
+    } else if (strcmp(mode, "value") == 0 && param != nullptr) {
+        if (!network.load(param)) {
+            cerr << "Cannot load weights: " << param << endl;
+            return 1;
+        }
+        variant = valueAi(iterations, &network);
+        name = "value";
+    } else {
+        usage();
+        return 1;
+    }
+
+    cout << name << " vs plain, " << iterations << " iterations" << endl;
+    testFirstPlayerWinRate({StringAIPair(name, variant), StringAIPair("plain", plainAi(iterations))}, games);
+    return 0;
+}
@@ -0,0 +1,103 @@
+// Builds an endgame bitbase for a position and writes it to a file.
+//
+// The bitbase holds the exact result of every position with at most K empty
+// cells that is reachable from the given position. Use it with
+// "analyze --bitbase FILE" or "setoption bitbase FILE" in the engine.
+#include "bitbase.h"
+#include "position.h"
+#include <iostream>
+#include <string.h>
+
+using namespace montecarlo_bit;
+using namespace std;
+
+static void usage() {
+    cerr << "Usage: bitbase [options] position\n"
+         << "  -k K      store positions with at most K empty cells (default 12)\n"
+         << "  -o FILE   write the bitbase to FILE\n"
+         << "  -m N      give up when one ply has more than N positions (default 100000000)\n"
+         << "  -c N      check N random positions against the alpha-beta solver\n"
+         << "position is a move sequence (\"4453\") or board rows separated by '/'.\n";
+}
+
+int main(int argc, char* argv[]) {
+    int max_empty = 12;
+    const char* out_path = nullptr;
+    const char* position = nullptr;
+    size_t max_positions = 100000000;
+    int checks = 0;
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (strcmp(arg, "-k") == 0 && has_value) {
+            max_empty = atoi(argv[++i]);
+        } else if (strcmp(arg, "-o") == 0 && has_value) {
+            out_path = argv[++i];
+        } else if (strcmp(arg, "-m") == 0 && has_value) {
+            max_positions = atoll(argv[++i]);
+        } else if (strcmp(arg, "-c") == 0 && has_value) {
+            checks = atoi(argv[++i]);
+        } else if (arg[0] != '-' && position == nullptr) {
+            position = arg;
+        } else {
+            usage();
+            return 1;
+        }
+    }
+    ConnectFourStateByBitSet root;
+    if (position == nullptr || !parsePosition(position, &root)) {
+        usage();
+        return 1;
+    }
+
+    Bitbase bitbase;
+    vector<size_t> layer_sizes;
+    auto start = chrono::steady_clock::now();
+    if (!bitbase.build(root, max_empty, max_positions, &layer_sizes)) {
+        cerr << "Cannot build the bitbase: too many positions; use a later position or a smaller K" << endl;
+        return 1;
+    }
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    cout << "positions per ply:";
+    for (const auto size : layer_sizes)
+        cout << " " << size;
+    cout << "\n";
+    size_t results[3] = {};
+    printf("%zu positions with at most %d empty cells, %zu bytes, %.2f s\n", bitbase.size(), max_empty, bitbase.bytes(), elapsed);
+    auto root_result = probeEndgame(root, &bitbase);
+    if (root_result != WinningStatus::NONE) {
+        static const char* names[] = {"win", "loss", "draw"};
+        printf("root: %s for the side to move\n", names[root_result]);
+    }
+
+    // Spot check: walk random games from the root and compare with the solver.
+    int mismatches = 0;
+    int checked = 0;
+    for (int i = 0; i < checks * 100 && checked < checks; ++i) {
+        ConnectFourStateByBitSet state = root;
+        while (!state.isDone() && probeEndgame(state, &bitbase) == WinningStatus::NONE)
+            state.advance(randomActionBit(state));
+        while (!state.isDone() && mt_for_action() % 3 != 0)
+            state.advance(randomActionBit(state));
+        if (state.isDone())
+            continue;
+        auto result = probeEndgame(state, &bitbase);
+        int score = solveNegamax(state, -1, 1);
+        auto expected = score > 0 ? WinningStatus::WIN : (score < 0 ? WinningStatus::LOSE : WinningStatus::DRAW);
+        ++results[result == WinningStatus::WIN ? 0 : (result == WinningStatus::LOSE ? 1 : 2)];
+        if (result != expected) {
+            ++mismatches;
+            cerr << "mismatch: " << formatRows(state) << endl;
+        }
+        ++checked;
+    }
+    if (checks > 0)
+        printf("checked %d positions (win %zu, loss %zu, draw %zu): %d mismatches\n", checked, results[0], results[1], results[2], mismatches);
+
+    if (out_path != nullptr && !bitbase.save(out_path)) {
+        cerr << "Cannot write: " << out_path << endl;
+        return 1;
+    }
+    return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,276 @@
+// 終盤の局面表 (bitbase)
+//
+// ある局面から到達できる、空きマスがK以下で終局していないすべての局面の勝敗を、
+// 石の多い局面から順に後退解析で求めて持つ。局面はキーの昇順に並べ、勝敗は1局面2ビットで持つ。
+// 引く時はキーを二分探索する。
+//
+// ファイル形式(数値はすべてリトルエンディアン):
+//   "C4BB" バージョン(1) H(1) W(1) K(1) 局面数(8)
+//   キー (各8バイト、昇順)
+//   勝敗 (2ビットずつ下位から詰める。0:負け 1:引き分け 2:勝ち)
+#pragma once
+#include "02_BitBoard.h"
+#include <cstring>
+#include <fstream>
+#include <istream>
+#include <ostream>
+
+namespace montecarlo_bit
+{
+    template <class BitState>
+    class BasicBitbase : public EndgameTable
+    {
+    private:
+        static_assert(sizeof(typename BitState::Bits) <= sizeof(uint64_t), "key does not fit in 64 bits");
+
+        static constexpr char MAGIC[4] = {'C', '4', 'B', 'B'};
+        static constexpr uint8_t VERSION = 1;
+
+        enum Value : uint8_t
+        {
+            LOSS = 0,
+            DRAW = 1,
+            WIN = 2,
+        };
+
+        int max_empty_ = -1;
+        std::vector<uint64_t> keys_;
+        std::vector<uint8_t> values_; // 4局面で1バイト
+
+        static int emptyCells(const BitState &state) { return BitState::H * BitState::W - bitCount(state.getAllBoard()); }
+
+        static constexpr size_t NOT_FOUND = SIZE_MAX;
+
+        // キーの位置を返す。なければNOT_FOUND
+        static size_t find(const std::vector<uint64_t> &keys, uint64_t key)
+        {
+            auto it = std::lower_bound(keys.begin(), keys.end(), key);
+            return it != keys.end() && *it == key ? static_cast<size_t>(it - keys.begin()) : NOT_FOUND;
+        }
+
+        // 1手後の局面の層から、この局面の手番のプレイヤーから見た値を求める。
+        // 1手後の局面が層になければfalseを返す
+        static bool solve(const BitState &state, const std::vector<uint64_t> &next_keys, const std::vector<uint8_t> &next_values, Value *result)
+        {
+            if (state.canWinNext())
+            {
+                *result = WIN;
+                return true;
+            }
+            Value best = LOSS;
+            const auto possible = state.possibleMoves();
+            for (int x = 0; x < BitState::W && best != WIN; x++)
+            {
+                if ((possible & BitState::Geometry::columnBits(x)) == 0)
+                    continue;
+                BitState next = state;
+                next.advance(x);
+                // 勝てる手はないので、終局するのは盤面が埋まった引き分けだけ
+                Value value = DRAW;
+                if (!next.isDone())
+                {
+                    const size_t index = find(next_keys, static_cast<uint64_t>(next.key()));
+                    if (index == NOT_FOUND)
+                        return false;
+                    value = static_cast<Value>(WIN - next_values[index]);
+                }
+                best = std::max(best, value);
+            }
+            *result = best;
+            return true;
+        }
+
+        Value valueAt(size_t i) const { return static_cast<Value>((values_[i / 4] >> (i % 4 * 2)) & 3); }
+
+    public:
+        BasicBitbase() {}
+
+        // rootから到達できる、空きマスがmax_empty以下の局面の表を作る。
+        // 途中の1手分の局面数がmax_positionsを超えたらfalseを返す。layer_sizesには手数ごとの局面数を入れる。
+        // 列挙した層に1手後の局面が見つからない場合(起きないはず)もfalseを返し、表は空にする
+        bool build(const BitState &root, int max_empty, size_t max_positions = SIZE_MAX, std::vector<size_t> *layer_sizes = nullptr)
+        {
+            max_empty_ = max_empty;
+            keys_.clear();
+            values_.clear();
+            if (layer_sizes != nullptr)
+                layer_sizes->clear();
+
+            // 表に入れる層だけを残しながら1手ずつ局面を列挙する
+            std::vector<std::vector<uint64_t>> layers;
+            std::vector<uint64_t> layer;
+            if (!root.isDone())
+                layer.emplace_back(static_cast<uint64_t>(root.key()));
+            int empty = emptyCells(root);
+            while (!layer.empty())
+            {
+                if (layer_sizes != nullptr)
+                    layer_sizes->emplace_back(layer.size());
+                std::vector<uint64_t> next;
+                for (const auto key : layer)
+                {
+                    const BitState state = BitState::fromKey(key);
+                    const auto possible = state.possibleMoves();
+                    for (int x = 0; x < BitState::W; x++)
+                    {
+                        if ((possible & BitState::Geometry::columnBits(x)) == 0)
+                            continue;
+                        BitState child = state;
+                        child.advance(x);
+                        if (!child.isDone())
+                            next.emplace_back(static_cast<uint64_t>(child.key()));
+                    }
+                }
+                std::sort(next.begin(), next.end());
+                next.erase(std::unique(next.begin(), next.end()), next.end());
+                if (next.size() > max_positions)
+                    return false;
+                if (empty <= max_empty)
+                    layers.emplace_back(std::move(layer));
+                layer = std::move(next);
+                --empty;
+            }
+
+            // 石の多い層から勝敗を求める
+            std::vector<std::vector<uint8_t>> values(layers.size());
+            for (size_t d = layers.size(); d-- > 0;)
+            {
+                static const std::vector<uint64_t> empty_keys;
+                static const std::vector<uint8_t> empty_values;
+                const auto &next_keys = d + 1 < layers.size() ? layers[d + 1] : empty_keys;
+                const auto &next_values = d + 1 < layers.size() ? values[d + 1] : empty_values;
+                values[d].resize(layers[d].size());
+                for (size_t i = 0; i < layers[d].size(); i++)
+                {
+                    Value value;
+                    if (!solve(BitState::fromKey(layers[d][i]), next_keys, next_values, &value))
+                        return false;
+                    values[d][i] = value;
+                }
+            }
+
+            // すべての層をキーの順に並べ直して詰める
+            std::vector<std::pair<uint64_t, uint8_t>> entries;
+            for (size_t d = 0; d < layers.size(); d++)
+            {
+                for (size_t i = 0; i < layers[d].size(); i++)
+                    entries.emplace_back(layers[d][i], values[d][i]);
+            }
+            std::sort(entries.begin(), entries.end());
+            keys_.resize(entries.size());
+            values_.assign((entries.size() + 3) / 4, 0);
+            for (size_t i = 0; i < entries.size(); i++)
+            {
+                keys_[i] = entries[i].first;
+                values_[i / 4] |= entries[i].second << (i % 4 * 2);
+            }
+            return true;
+        }
+
+        size_t size() const { return keys_.size(); }
+        size_t bytes() const { return keys_.size() * sizeof(uint64_t) + values_.size(); }
+
+        int maxEmptyCells() const override { return max_empty_; }
+
+        WinningStatus probe(uint64_t key) const override
+        {
+            const size_t index = find(keys_, key);
+            if (index == NOT_FOUND)
+                return WinningStatus::NONE;
+            switch (valueAt(index))
+            {
+            case WIN:
+                return WinningStatus::WIN;
+            case LOSS:
+                return WinningStatus::LOSE;
+            default:
+                return WinningStatus::DRAW;
+            }
+        }
+
+        bool save(std::ostream &os) const
+        {
+            char header[16] = {};
+            std::memcpy(header, MAGIC, 4);
+            header[4] = VERSION;
+            header[5] = BitState::H;
+            header[6] = BitState::W;
+            header[7] = static_cast<char>(max_empty_);
+            const uint64_t count = keys_.size();
+            for (int i = 0; i < 8; i++)
+                header[8 + i] = static_cast<char>(count >> (8 * i));
+            os.write(header, sizeof(header));
+            for (const auto key : keys_)
+            {
+                char buf[8];
+                for (int i = 0; i < 8; i++)
+                    buf[i] = static_cast<char>(key >> (8 * i));
+                os.write(buf, sizeof(buf));
+            }
+            os.write(reinterpret_cast<const char *>(values_.data()), values_.size());
+            return os.good();
+        }
+
+        bool save(const char *path) const
+        {
+            std::ofstream ofs(path, std::ios::binary);
+            return ofs && save(ofs);
+        }
+
+        bool load(std::istream &is)
+        {
+            uint8_t header[16];
+            if (!is.read(reinterpret_cast<char *>(header), sizeof(header)))
+                return false;
+            if (std::memcmp(header, MAGIC, 4) != 0 || header[4] != VERSION || header[5] != BitState::H || header[6] != BitState::W)
+                return false;
+            uint64_t count = 0;
+            for (int i = 0; i < 8; i++)
+                count |= uint64_t(header[8 + i]) << (8 * i);
+            // 壊れたファイルの局面数で大きな領域を確保しないように、読める大きさと比べてから確保する。
+            // 大きさがわからないストリームでは読めた分だけ領域を増やす
+            std::vector<uint64_t> keys;
+            const std::streampos start = is.tellg();
+            if (start != std::streampos(-1))
+            {
+                is.seekg(0, std::ios::end);
+                const std::streampos end = is.tellg();
+                is.seekg(start);
+                if (end == std::streampos(-1) || !is)
+                    return false;
+                const uint64_t remaining = static_cast<uint64_t>(end - start);
+                if (count > remaining / 8 || count * 8 + (count + 3) / 4 != remaining)
+                    return false;
+                keys.reserve(count);
+            }
+            for (uint64_t n = 0; n < count; n++)
+            {
+                uint8_t buf[8];
+                if (!is.read(reinterpret_cast<char *>(buf), sizeof(buf)))
+                    return false;
+                uint64_t key = 0;
+                for (int i = 0; i < 8; i++)
+                    key |= uint64_t(buf[i]) << (8 * i);
+                // probe()は二分探索するので、キーは狭義の昇順でなければならない
+                if (!keys.empty() && keys.back() >= key)
+                    return false;
+                keys.emplace_back(key);
+            }
+            std::vector<uint8_t> values((count + 3) / 4);
+            if (!is.read(reinterpret_cast<char *>(values.data()), values.size()))
+                return false;
+            max_empty_ = header[7];
+            keys_ = std::move(keys);
+            values_ = std::move(values);
+            return true;
+        }
+
+        bool load(const char *path)
+        {
+            std::ifstream ifs(path, std::ios::binary);
+            return ifs && load(ifs);
+        }
+    };
+
+    using Bitbase = BasicBitbase<ConnectFourStateByBitSet>;
+}
@@ -1,31 +1,38 @@
 #include "02_BitBoard.h"
+#include "tree_io.h"
 #include <iostream>
+#include <random>
+#include <string.h>
 
 using namespace montecarlo_bit;
 using namespace std;
 
-static int tryMcts(Node* root_node, const vector<int>& legal_actions, const int64_t count, int for_draw, double CCC)
+// Upper bound of search tree nodes; least visited subtrees are collapsed beyond it.
+static const size_t NODE_BUDGET = 1 << 20;
+
+static int tryMcts(Node* root_node, const int64_t count, int for_draw, double CCC, SearchContext* ctx)
 {
-    root_node->expand();
+    if (!root_node->isExpanded())
+        root_node->expand(ctx);
     for (int cnt = 0; cnt < count; cnt++)
     {
-        root_node->evaluate(for_draw, CCC);
+        int playout_player = -1;
+        root_node->evaluate(for_draw, CCC, &playout_player, ctx);
+        ctx->pool->trimIfNeeded(*root_node);
     }
 
     int best_action_searched_number = -1;
-    int best_action_index = -1;
-    assert(legal_actions.size() == root_node->child_nodes_.size());
-    for (int i = 0; i < legal_actions.size(); i++)
+    int best_action = -1;
+    for (const auto& child : root_node->child_nodes_)
     {
-        const Node* child = &root_node->child_nodes_[i];
-        int n = child->n_;
+        int n = child.n_;
         if (n > best_action_searched_number)
         {
-            best_action_index = i;
+            best_action = child.getAction();
             best_action_searched_number = n;
         }
     }
-    return legal_actions[best_action_index];
+    return best_action;
 }
 
 string make_indent(int n) {
@@ -51,11 +58,8 @@ static void dump_node(const Node* node, int recur) {
     if (state.isDone()) {
         cout << indent << "WinningState=" << state.getWinningStatus() << endl;
     } else if (!node->child_nodes_.empty()) {
-        const auto& actions = state.legalActions();
-        assert(actions.size() == node->child_nodes_.size());
-        for (size_t i = 0; i < node->child_nodes_.size(); ++i) {
-            const auto& child = node->child_nodes_[i];
-            int action = actions[i];
+        for (const auto& child : node->child_nodes_) {
+            int action = child.getAction();
             printf("%sact %d: w=%.2f, n=%d rate=%.2f%%\n", indent.c_str(), action, child.getW(), (int)child.n_, 100 * child.getW() / child.n_);
         }
     }
@@ -75,18 +79,276 @@ static void dump_node_recur(const Node* node, int recur) {
         int next_recur = recur + 1;
         const ConnectFourStateByBitSet& state = node->getState();
         const char *c = state.isFirst() ? u8"❌" : u8"🟢";
-        const auto actions = state.legalActions();
-        for (size_t i = 0; i < node->child_nodes_.size(); ++i) {
-            const auto& child = node->child_nodes_[i];
-            assert(actions.size() == node->child_nodes_.size());
-            int action = actions[i];
+        for (const auto& child : node->child_nodes_) {
+            int action = child.getAction();
             cout << make_indent(recur) << c << ": act=" << action << endl;
             dump_node_recur(&child, next_recur);
         }
     }
 }
 
-int main() {
+// Prints the top levels of a saved tree without building nodes.
+static int view_tree(const char* path, int max_depth) {
+    MappedFile file;
+    if (!file.open(path)) {
+        cerr << "Cannot open: " << path << endl;
+        return 1;
+    }
+    TreeView view(file.data(), file.size());
+    if (!view.isValid()) {
+        cerr << "Invalid tree file: " << path << endl;
+        return 1;
+    }
+    cout << view.getRootState().toString();
+    size_t node_count = 0;
+    bool ok = view.forEach([&](int depth, int action, const ConnectFourStateByBitSet&, double n, double w) {
+        ++node_count;
+        if (depth == 0 || depth > max_depth)
+            return depth <= max_depth;
+        printf("%sact %d: w=%.2f, n=%d rate=%.2f%%\n", make_indent(depth - 1).c_str(), action, w, (int)n, 100 * w / n);
+        return true;
+    });
+    if (!ok) {
+        cerr << "Broken tree file: " << path << endl;
+        return 1;
+    }
+    cout << "nodes read: " << node_count << endl;
+    return 0;
+}
+
+// Board cells as 0 (empty), 1 (first player) or 2 (second player), scanned
+// cell by cell so the bitboard results can be checked against it.
+template <class BitState>
+struct NaiveBoard {
+    static constexpr int H = BitState::H;
+    static constexpr int W = BitState::W;
+    int cells[W][H];
+
+    explicit NaiveBoard(const BitState& state) {
+        for (int x = 0; x < W; ++x)
+            for (int y = 0; y < H; ++y)
+                cells[x][y] = state.getCell(x, y);
+    }
+
+    int height(int x) const {
+        int y = 0;
+        while (y < H && cells[x][y] != 0)
+            ++y;
+        return y;
+    }
+
+    bool isFull() const {
+        for (int x = 0; x < W; ++x)
+            if (height(x) < H)
+                return false;
+        return true;
+    }
+
+    // Whether player has four in a row through (x, y).
+    bool fourThrough(int x, int y, int player) const {
+        static const int directions[4][2] = {{1, 0}, {0, 1}, {1, 1}, {1, -1}};
+        for (const auto& d : directions) {
+            int count = 1;
+            for (int sign : {1, -1}) {
+                int cx = x + sign * d[0], cy = y + sign * d[1];
+                while (cx >= 0 && cx < W && cy >= 0 && cy < H && cells[cx][cy] == player) {
+                    ++count;
+                    cx += sign * d[0];
+                    cy += sign * d[1];
+                }
+            }
+            if (count >= 4)
+                return true;
+        }
+        return false;
+    }
+
+    bool hasFour(int player) const {
+        for (int x = 0; x < W; ++x)
+            for (int y = 0; y < H; ++y)
+                if (cells[x][y] == player && fourThrough(x, y, player))
+                    return true;
+        return false;
+    }
+
+    // Empty cells, playable or not, where a stone of player makes four.
+    typename BitState::Bits winningCells(int player) const {
+        NaiveBoard board = *this;
+        typename BitState::Bits cells = 0;
+        for (int x = 0; x < W; ++x) {
+            for (int y = 0; y < H; ++y) {
+                if (board.cells[x][y] != 0)
+                    continue;
+                board.cells[x][y] = player;
+                if (board.fourThrough(x, y, player))
+                    cells |= typename BitState::Bits(1) << (x * (H + 1) + y);
+                board.cells[x][y] = 0;
+            }
+        }
+        return cells;
+    }
+
+    // Whether player can make four with the next stone.
+    bool canWinNext(int player) const {
+        NaiveBoard board = *this;
+        for (int x = 0; x < W; ++x) {
+            const int y = height(x);
+            if (y == H)
+                continue;
+            board.cells[x][y] = player;
+            if (board.fourThrough(x, y, player))
+                return true;
+            board.cells[x][y] = 0;
+        }
+        return false;
+    }
+};
+
+// Plays random games until `positions` positions were seen and compares
+// legal moves, win detection, key() round trips and the threat queries
+// with a naive scan. Returns the number of mismatches.
+template <class BitState>
+static int checkBoard(const char* name, int positions, uint32_t seed) {
+    mt19937 random(seed);
+    int checked = 0;
+    int errors = 0;
+    auto fail = [&](const BitState& state, const char* what) {
+        if (errors++ < 10)
+            cerr << name << ": " << what << " mismatch\n" << state.toString();
+    };
+    while (checked < positions) {
+        BitState state;
+        while (!state.isDone() && checked < positions) {
+            ++checked;
+            const NaiveBoard<BitState> board(state);
+            vector<int> legal;
+            for (int x = 0; x < BitState::W; ++x)
+                if (board.height(x) < BitState::H)
+                    legal.emplace_back(x);
+            const auto actions = state.legalActions();
+            if (actions != legal)
+                fail(state, "legalActions");
+            if (BitState::fromKey(state.key()) != state)
+                fail(state, "fromKey");
+
+            const int player = state.isFirst() ? 1 : 2;
+            const int opponent = 3 - player;
+            const auto my_cells = board.winningCells(player);
+            const auto opponent_cells = board.winningCells(opponent);
+            if (state.myWinningCells() != my_cells ||
+                BitState::winningCells(state.getMyBoard(), state.getAllBoard()) != my_cells)
+                fail(state, "myWinningCells");
+            if (state.opponentWinningCells() != opponent_cells)
+                fail(state, "opponentWinningCells");
+            typename BitState::Bits playable = 0;
+            for (const int x : legal)
+                playable |= typename BitState::Bits(1) << (x * (BitState::H + 1) + board.height(x));
+            if (state.possibleMoves() != playable)
+                fail(state, "possibleMoves");
+            if (state.winningMoves() != (playable & my_cells) || state.canWinNext() != board.canWinNext(player))
+                fail(state, "winningMoves");
+            // A move does not lose when the opponent cannot make four right
+            // after it. Positions with a winning move are skipped: there the
+            // winning move is played and nonLosingMoves() is not consulted.
+            if (!state.canWinNext()) {
+                typename BitState::Bits non_losing = 0;
+                for (const int x : legal) {
+                    NaiveBoard<BitState> after = board;
+                    after.cells[x][board.height(x)] = player;
+                    if (!after.canWinNext(opponent))
+                        non_losing |= typename BitState::Bits(1) << (x * (BitState::H + 1) + board.height(x));
+                }
+                if (state.nonLosingMoves() != non_losing)
+                    fail(state, "nonLosingMoves");
+                const auto forced = playable & opponent_cells;
+                const int expected = forced == 0 ? -1 : ((forced & (forced - 1)) != 0 ? -2 : BitState::cellColumn(forced));
+                if (state.forcedAction() != expected)
+                    fail(state, "forcedAction");
+            }
+
+            state.advance(actions[random() % actions.size()]);
+            const NaiveBoard<BitState> next(state);
+            const WinningStatus expected = next.hasFour(player) ? WinningStatus::LOSE : (next.isFull() ? WinningStatus::DRAW : WinningStatus::NONE);
+            if (state.getWinningStatus() != expected)
+                fail(state, "winning status");
+        }
+    }
+    printf("%s: %d positions, %d mismatches\n", name, checked, errors);
+    return errors;
+}
+
+// Plays one game with a short search per move, with the context options
+// that have board-specific code enabled, so that MCTS is built and run
+// for the board.
+template <class BitState>
+static int checkMcts(const char* name, int iterations) {
+    BasicNodePool<BitState> pool(NODE_BUDGET);
+    BasicSearchContext<BitState> ctx;
+    ctx.pool = &pool;
+    ctx.rave_equivalence = 100;
+    ctx.prior_visits = 20;
+    ctx.last_good_reply = true;
+    ctx.solve_empty_cells = 8;
+    BitState state;
+    int moves = 0;
+    while (!state.isDone()) {
+        const int action = mctsActionBitWithIterations(state, iterations, 0, 1., &ctx);
+        const auto legal = state.legalActions();
+        if (find(legal.begin(), legal.end(), action) == legal.end()) {
+            cerr << name << ": illegal search move " << action << "\n" << state.toString();
+            return 1;
+        }
+        state.advance(action);
+        ++moves;
+    }
+    if (pool.size() != 0) {
+        cerr << name << ": " << pool.size() << " nodes left in the pool\n";
+        return 1;
+    }
+    printf("%s: searched game of %d moves, result %d\n", name, moves, state.getWinningStatus());
+    return 0;
+}
+
+static int runChecks(int positions) {
+    int errors = 0;
+    errors += checkBoard<BasicConnectFourStateByBitSet<6, 7>>("6x7", positions, 1);
+    errors += checkBoard<BasicConnectFourStateByBitSet<7, 8>>("7x8", positions, 2);
+    errors += checkBoard<BasicConnectFourStateByBitSet<8, 9>>("8x9", positions, 3);
+    errors += checkMcts<BasicConnectFourStateByBitSet<6, 7>>("6x7", 300);
+    errors += checkMcts<BasicConnectFourStateByBitSet<7, 8>>("7x8", 300);
+    errors += checkMcts<BasicConnectFourStateByBitSet<8, 9>>("8x9", 300);
+    return errors == 0 ? 0 : 1;
+}
+
+static void usage() {
+    cerr << "Usage: cpptest [-n iterations] [-r resume.tree] [-w save.tree] [-v view.tree [depth]] [-c positions]\n"
+         << "  -c N  check the bitboards and threat queries of 6x7, 7x8 and 8x9 boards\n"
+         << "        against a naive scan on N random positions each" << endl;
+}
+
+int main(int argc, char* argv[]) {
+    int64_t iterations = 500000;
+    const char* resume_path = nullptr;
+    const char* save_path = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            iterations = atoll(argv[++i]);
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            resume_path = argv[++i];
+        } else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            save_path = argv[++i];
+        } else if (strcmp(argv[i], "-v") == 0 && i + 1 < argc) {
+            const char* path = argv[++i];
+            int depth = i + 1 < argc ? atoi(argv[++i]) : 2;
+            return view_tree(path, depth);
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            return runChecks(atoi(argv[++i]));
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
     static const char *table[] = {
         "xxoxo..",
         "oooxx.x",
@@ -130,14 +392,31 @@ int main() {
     double CCC = for_draw ? 3 : 1;
     ConnectFourStateByBitSet bitstate = ConnectFourStateByBitSet(state);
     Node root_node = Node(bitstate);
-    auto action = tryMcts(&root_node, bitstate.legalActions(), 500000, for_draw ? 1 : 0, CCC);
+    NodePool pool(NODE_BUDGET);
+    SearchContext ctx;
+    ctx.pool = &pool;
+    if (resume_path != nullptr) {
+        if (!readTree(resume_path, &root_node, &ctx) || root_node.getState() != bitstate) {
+            cerr << "Cannot resume from: " << resume_path << endl;
+            return 1;
+        }
+    }
+    auto action = tryMcts(&root_node, iterations, for_draw ? 1 : 0, CCC, &ctx);
     // state.advance(action);
 
     // cout << "Action: " << action << endl;
     // cout << state.toString() << endl;
 
-    dump_node_recur(&root_node, 0);
+    if (save_path != nullptr) {
+        if (!writeTree(save_path, root_node)) {
+            cerr << "Cannot save to: " << save_path << endl;
+            return 1;
+        }
+        return 0;
+    }
 
+    dump_node_recur(&root_node, 0);
+    cout << "best action: " << action << endl;
 
     return 0;
 }
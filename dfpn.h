@@ -0,0 +1,388 @@
+// 証明数探索 (df-pn) で局面を読み切る
+//
+// 「攻め方が勝つ」ことを証明(または反証)する。攻め方の手番の局面はOR、守り方の手番の局面はAND。
+// 証明数・反証数は大きさが決まった置換表だけに持つので、探索が長くなってもメモリは増えない。
+// 表が埋まったら、そこまでに読んだ局面数が最も少ないエントリを上書きする。
+// 子の閾値には 1+ε の工夫を使い、兄弟の間を行き来する回数を減らす。
+//
+// 勝てる手があれば即座に決着、相手の勝ちを2か所以上防ぐ必要があれば負けとし、
+// 子はnonLosingMoves()の手だけに絞る。Connect Fourは同じ局面に戻らないので、循環の問題はない。
+#pragma once
+#include "02_BitBoard.h"
+#include <memory>
+
+namespace montecarlo_bit
+{
+    enum class ProofResult
+    {
+        PROVEN,
+        DISPROVEN,
+        UNKNOWN, // 局面数の上限で打ち切った
+    };
+
+    template <class BitState>
+    class BasicDfpnSolver
+    {
+    private:
+        using Bits = typename BitState::Bits;
+        using Geometry = typename BitState::Geometry;
+        static_assert(Geometry::BITS <= 63, "key does not fit in 63 bits");
+
+        static constexpr uint32_t INF = 1u << 30;
+        static constexpr int WAYS = 4; // 1つのキーを置けるエントリ数
+
+        struct Entry
+        {
+            uint64_t key;
+            uint32_t pn;
+            uint32_t dn;
+            uint64_t work; // この局面から読んだ局面数。0なら空き
+        };
+
+        // 攻め方から見た証明数・反証数
+        struct Numbers
+        {
+            uint32_t pn;
+            uint32_t dn;
+            uint64_t work;
+        };
+
+        std::unique_ptr<Entry[]> entries_;
+        size_t buckets_ = 0;
+        uint64_t nodes_ = 0;
+        uint64_t max_nodes_ = 0;
+        uint64_t stored_ = 0;
+        uint64_t replaced_ = 0;
+        bool attacker_is_first_ = true;
+
+        static uint32_t saturate(uint64_t n) { return n >= INF ? INF : static_cast<uint32_t>(n); }
+
+        // 攻め方を最上位ビットに入れて、2つの問いの結果を同じ表に置く
+        uint64_t tableKey(const BitState &state) const
+        {
+            return static_cast<uint64_t>(state.key()) | (uint64_t(attacker_is_first_) << 63);
+        }
+
+        Entry *bucket(uint64_t key) const
+        {
+            uint64_t h = key * 0x9E3779B97F4A7C15ULL;
+            h ^= h >> 29;
+            return &entries_[(h % buckets_) * WAYS];
+        }
+
+        bool lookup(uint64_t key, Numbers *numbers) const
+        {
+            const Entry *entries = bucket(key);
+            for (int i = 0; i < WAYS; i++)
+            {
+                if (entries[i].work != 0 && entries[i].key == key)
+                {
+                    *numbers = Numbers{entries[i].pn, entries[i].dn, entries[i].work};
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void store(uint64_t key, const Numbers &numbers)
+        {
+            Entry *entries = bucket(key);
+            Entry *victim = &entries[0];
+            for (int i = 0; i < WAYS; i++)
+            {
+                if (entries[i].work == 0 || entries[i].key == key)
+                {
+                    victim = &entries[i];
+                    break;
+                }
+                if (entries[i].work < victim->work)
+                    victim = &entries[i];
+            }
+            if (victim->work == 0)
+                ++stored_;
+            else if (victim->key != key)
+                ++replaced_;
+            *victim = Entry{key, numbers.pn, numbers.dn, std::max<uint64_t>(1, numbers.work)};
+        }
+
+        bool isOrNode(const BitState &state) const { return state.isFirst() == attacker_is_first_; }
+
+        // 読まずにわかる値。決着がつかなければ子の数を初期値にする
+        Numbers leaf(const BitState &state) const
+        {
+            const bool or_node = isOrNode(state);
+            // 勝ちの手は親で見つけているので、終局しているのは引き分けだけ
+            if (state.isDone())
+                return Numbers{INF, 0, 0};
+            if (state.canWinNext())
+                return or_node ? Numbers{0, INF, 0} : Numbers{INF, 0, 0};
+            const Bits moves = state.nonLosingMoves();
+            if (moves == 0)
+                return or_node ? Numbers{INF, 0, 0} : Numbers{0, INF, 0};
+            const uint32_t count = bitCount(moves);
+            return or_node ? Numbers{1, count, 0} : Numbers{count, 1, 0};
+        }
+
+        Numbers numbers(const BitState &state) const
+        {
+            Numbers result;
+            if (!state.isDone() && lookup(tableKey(state), &result))
+                return result;
+            return leaf(state);
+        }
+
+        int children(const BitState &state, BitState *next) const
+        {
+            const Bits moves = state.nonLosingMoves();
+            int count = 0;
+            for (int i = 0; i < BitState::W; i++)
+            {
+                const int x = solverColumn<BitState>(i);
+                if ((moves & Geometry::columnBits(x)) == 0)
+                    continue;
+                next[count] = state;
+                next[count].advance(x);
+                ++count;
+            }
+            return count;
+        }
+
+        // 証明数・反証数のどちらかが閾値に届くまで読む。leaf()で決着がつかない局面のみ
+        Numbers search(const BitState &state, uint32_t th_pn, uint32_t th_dn)
+        {
+            const uint64_t key = tableKey(state);
+            const uint64_t start = nodes_;
+            uint64_t work = 0;
+            Numbers previous;
+            if (lookup(key, &previous))
+                work = previous.work;
+
+            const bool or_node = isOrNode(state);
+            BitState next[BitState::W];
+            const int count = children(state, next);
+            // 子の値は手元に持ち、読んだ子だけ返り値で更新する。表から消えても読み直しを繰り返さない
+            Numbers child_numbers[BitState::W];
+            for (int i = 0; i < count; i++)
+                child_numbers[i] = numbers(next[i]);
+            Numbers result;
+            while (true)
+            {
+                ++nodes_;
+                // ORでは証明数の最小と反証数の和、ANDではその逆。
+                // best はORなら証明数、ANDなら反証数が最小の子
+                uint64_t sum = 0;
+                uint32_t first = INF + 1;
+                uint32_t second = INF + 1;
+                int best = -1;
+                Numbers best_numbers{};
+                for (int i = 0; i < count; i++)
+                {
+                    const Numbers &child = child_numbers[i];
+                    const uint32_t selector = or_node ? child.pn : child.dn;
+                    sum += or_node ? child.dn : child.pn;
+                    if (selector < first)
+                    {
+                        second = first;
+                        first = selector;
+                        best = i;
+                        best_numbers = child;
+                    }
+                    else if (selector < second)
+                    {
+                        second = selector;
+                    }
+                }
+                second = std::min(second, INF);
+                result = or_node ? Numbers{first, saturate(sum), 0} : Numbers{saturate(sum), first, 0};
+                if (result.pn >= th_pn || result.dn >= th_dn || nodes_ >= max_nodes_)
+                    break;
+
+                // 2番目の子を (1+ε) 倍まで超えない範囲で最善の子を読む
+                const uint32_t th = or_node ? th_pn : th_dn;
+                const uint32_t th_other = or_node ? th_dn : th_pn;
+                const uint32_t total = or_node ? result.dn : result.pn;
+                const uint32_t child_part = or_node ? best_numbers.dn : best_numbers.pn;
+                const uint32_t child_th = saturate(std::min<uint64_t>(th, uint64_t(second) + second / 4 + 1));
+                const uint32_t child_th_other = th_other >= INF ? INF : saturate(uint64_t(th_other) - total + child_part);
+                if (or_node)
+                    child_numbers[best] = search(next[best], child_th, child_th_other);
+                else
+                    child_numbers[best] = search(next[best], child_th_other, child_th);
+            }
+            result.work = work + (nodes_ - start);
+            store(key, result);
+            return result;
+        }
+
+        ProofResult resultOf(const Numbers &numbers) const
+        {
+            if (numbers.pn == 0)
+                return ProofResult::PROVEN;
+            if (numbers.dn == 0)
+                return ProofResult::DISPROVEN;
+            return ProofResult::UNKNOWN;
+        }
+
+        Numbers searchRoot(const BitState &state)
+        {
+            const Numbers numbers = leaf(state);
+            if (numbers.pn == 0 || numbers.dn == 0)
+                return numbers;
+            return search(state, INF, INF);
+        }
+
+        // 証明(反証)の木に沿った手順を作る。攻め方が選ぶ局面では一番早く決着する子、
+        // 相手が選ぶ局面では一番読むのに手間のかかった子を選ぶ
+        void principalLine(BitState state, bool proven, std::vector<int> *line)
+        {
+            line->clear();
+            while (!state.isDone())
+            {
+                const Bits winning = state.winningMoves();
+                if (winning != 0)
+                {
+                    line->emplace_back(BitState::cellColumn(winning));
+                    return;
+                }
+                if (state.nonLosingMoves() == 0)
+                {
+                    // 防ぎきれないので、どこに打っても相手が勝つ
+                    const int action = BitState::cellColumn(state.possibleMoves());
+                    line->emplace_back(action);
+                    state.advance(action);
+                    line->emplace_back(BitState::cellColumn(state.winningMoves()));
+                    return;
+                }
+                // 攻め方が証明を、守り方が反証を選ぶ局面かどうか
+                const bool choosing = isOrNode(state) == proven;
+                BitState next[BitState::W];
+                const int count = children(state, next);
+                int best = -1;
+                uint64_t best_work = 0;
+                for (int i = 0; i < count; i++)
+                {
+                    Numbers child = numbers(next[i]);
+                    if (resultOf(child) == ProofResult::UNKNOWN)
+                        child = searchRoot(next[i]);
+                    if (resultOf(child) != (proven ? ProofResult::PROVEN : ProofResult::DISPROVEN))
+                        continue;
+                    if (best < 0 || (choosing ? child.work < best_work : child.work > best_work))
+                    {
+                        best = i;
+                        best_work = child.work;
+                    }
+                }
+                if (best < 0)
+                    return; // 局面数の上限で読めなかった
+                line->emplace_back(BitState::cellColumn(next[best].getAllBoard() ^ state.getAllBoard()));
+                state = next[best];
+            }
+        }
+
+        // attacker_is_firstの側が勝つことが証明できるか。表になければ読む
+        bool isProven(const BitState &state, bool attacker_is_first)
+        {
+            attacker_is_first_ = attacker_is_first;
+            Numbers child = numbers(state);
+            if (resultOf(child) == ProofResult::UNKNOWN)
+                child = searchRoot(state);
+            return child.pn == 0;
+        }
+
+        // 引き分けの局面から、どちらも勝ちを証明できない子をたどる
+        void drawLine(BitState state, std::vector<int> *line)
+        {
+            line->clear();
+            while (!state.isDone())
+            {
+                BitState next[BitState::W];
+                const int count = children(state, next);
+                int i = 0;
+                while (i < count && (isProven(next[i], true) || isProven(next[i], false)))
+                    i++;
+                if (i == count)
+                    return;
+                line->emplace_back(BitState::cellColumn(next[i].getAllBoard() ^ state.getAllBoard()));
+                state = next[i];
+            }
+        }
+
+    public:
+        // table_bytesが置換表に使うメモリのすべて
+        explicit BasicDfpnSolver(size_t table_bytes)
+            : buckets_(std::max<size_t>(1, table_bytes / (sizeof(Entry) * WAYS)))
+        {
+            entries_.reset(new Entry[buckets_ * WAYS]);
+            clear();
+        }
+
+        void clear()
+        {
+            for (size_t i = 0; i < buckets_ * WAYS; i++)
+                entries_[i] = Entry{0, 0, 0, 0};
+            stored_ = 0;
+            replaced_ = 0;
+        }
+
+        size_t capacity() const { return buckets_ * WAYS; }
+        size_t bytes() const { return capacity() * sizeof(Entry); }
+        uint64_t nodes() const { return nodes_; }
+        uint64_t stored() const { return stored_; }     // 空きに書いたエントリ数
+        uint64_t replaced() const { return replaced_; } // ほかの局面を上書きした回数
+
+        // attacker_is_firstの側が勝つことを証明する。lineがあれば証明(反証)の手順を入れる。
+        // 読んだ局面数がmax_nodesに達したらUNKNOWNを返す
+        ProofResult prove(const BitState &state, bool attacker_is_first, uint64_t max_nodes, std::vector<int> *line = nullptr)
+        {
+            attacker_is_first_ = attacker_is_first;
+            max_nodes_ = max_nodes > UINT64_MAX - nodes_ ? UINT64_MAX : nodes_ + max_nodes;
+            const ProofResult result = resultOf(searchRoot(state));
+            if (line != nullptr)
+            {
+                line->clear();
+                if (result != ProofResult::UNKNOWN)
+                {
+                    max_nodes_ = UINT64_MAX;
+                    principalLine(state, result == ProofResult::PROVEN, line);
+                }
+            }
+            return result;
+        }
+
+        // 手番のプレイヤーから見た勝敗を求める。勝ちを証明できなければ相手の勝ちを証明しにいく。
+        // lineがあれば双方が最善を尽くす手順を入れる。打ち切ったらNONEを返す
+        WinningStatus solve(const BitState &state, uint64_t max_nodes, std::vector<int> *line = nullptr)
+        {
+            const uint64_t limit = max_nodes > UINT64_MAX - nodes_ ? UINT64_MAX : nodes_ + max_nodes;
+            if (line != nullptr)
+                line->clear();
+            const ProofResult win = prove(state, state.isFirst(), max_nodes);
+            if (win == ProofResult::UNKNOWN)
+                return WinningStatus::NONE;
+            ProofResult loss = ProofResult::DISPROVEN;
+            if (win == ProofResult::DISPROVEN)
+            {
+                loss = prove(state, !state.isFirst(), limit > nodes_ ? limit - nodes_ : 0);
+                if (loss == ProofResult::UNKNOWN)
+                    return WinningStatus::NONE;
+            }
+            const WinningStatus result = win == ProofResult::PROVEN ? WinningStatus::WIN : (loss == ProofResult::PROVEN ? WinningStatus::LOSE : WinningStatus::DRAW);
+            if (line != nullptr)
+            {
+                max_nodes_ = UINT64_MAX;
+                if (result == WinningStatus::DRAW)
+                {
+                    drawLine(state, line);
+                }
+                else
+                {
+                    attacker_is_first_ = (result == WinningStatus::WIN) == state.isFirst();
+                    principalLine(state, true, line);
+                }
+            }
+            return result;
+        }
+    };
+
+    using DfpnSolver = BasicDfpnSolver<ConnectFourStateByBitSet>;
+}
@@ -0,0 +1,350 @@
+// Long-running engine that reads commands from stdin and answers on stdout.
+//
+// Commands (one per line, columns are 1-based):
+//   newgame                       forget the search tree
+//   position startpos [moves M]   set the position; M is a move sequence like "4453"
+//   position M                    same as "position startpos moves M"
+//   position rows R [moves M]     board rows from the top separated by '/'
+//   go [iterations N] [movetime MS] [infinite] [draw]
+//                                 search in the background, then print
+//                                 "bestmove C value V visits a,b,..." and "info ..."
+//   ponder [draw]                 search until the next command without printing
+//   stop                          stop the search; prints bestmove unless pondering
+//   setoption NAME VALUE          nodes (tree node budget), prior, rave, lgr (0/1),
+//                                 solve (solve leaves with at most VALUE empty cells),
+//                                 cache (file of solved positions shared between processes),
+//                                 bitbase (endgame bitbase file written by the bitbase tool),
+//                                 value (n-tuple weight file written by ntrain, used instead of playouts)
+//   isready                       prints "readyok"
+//   quit
+// Any command other than stop/isready cancels a running search without output.
+// The tree is kept between commands. A new position that is reachable from the
+// current one within a few moves reuses the matching subtree.
+#include "02_BitBoard.h"
+#include "bitbase.h"
+#include "ntuple.h"
+#include "position.h"
+#include "solved_cache.h"
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+using namespace montecarlo_bit;
+using namespace std;
+
+// Deepest subtree searched for the new position when it changes.
+static const int REUSE_DEPTH = 4;
+static const size_t DEFAULT_NODE_BUDGET = 1 << 22;
+static const uint64_t DEFAULT_CACHE_ENTRIES = 1 << 22;
+
+static mutex output_mutex;
+
+static void send(const string& line) {
+    lock_guard<mutex> lock(output_mutex);
+    cout << line << '\n' << flush;
+}
+
+struct Limits {
+    int64_t iterations = 0;   // 0 for no limit
+    int64_t movetime = 0;     // ms, 0 for no limit
+    bool for_draw = false;
+    bool ponder = false;      // no output unless stopped explicitly
+};
+
+class Engine {
+private:
+    ConnectFourStateByBitSet position_;
+    Node root_;
+    NodePool pool_;
+    SearchContext ctx_;
+    SolvedCache cache_;
+    Bitbase bitbase_;
+    NTupleNetwork network_;
+
+    thread thread_;
+    mutex mutex_;
+    condition_variable cv_;
+    bool has_job_ = false;
+    bool searching_ = false;
+    bool quit_ = false;
+    atomic<bool> stop_{false};
+    bool report_on_stop_ = false;
+    Limits limits_;
+
+public:
+    Engine() : root_(ConnectFourStateByBitSet()), pool_(DEFAULT_NODE_BUDGET) {
+        ctx_.pool = &pool_;
+        root_.expand(&ctx_);
+        thread_ = thread(&Engine::run, this);
+    }
+
+    ~Engine() {
+        stop(false);
+        {
+            lock_guard<mutex> lock(mutex_);
+            quit_ = true;
+        }
+        cv_.notify_all();
+        thread_.join();
+    }
+
+    void newGame() {
+        stop(false);
+        setRoot(ConnectFourStateByBitSet());
+    }
+
+    void setPosition(const ConnectFourStateByBitSet& state) {
+        stop(false);
+        if (state == position_)
+            return;
+        Node* node = findNode(&root_, state, REUSE_DEPTH);
+        if (node == nullptr) {
+            setRoot(state);
+            return;
+        }
+        Node promoted = std::move(*node);
+        pool_.release(&root_.child_nodes_);
+        root_ = std::move(promoted);
+        position_ = state;
+        if (!root_.isExpanded())
+            root_.expand(&ctx_);
+    }
+
+    void go(const Limits& limits) {
+        stop(false);
+        if (position_.isDone()) {
+            send("bestmove none");
+            return;
+        }
+        lock_guard<mutex> lock(mutex_);
+        limits_ = limits;
+        report_on_stop_ = !limits.ponder;
+        stop_ = false;
+        has_job_ = true;
+        searching_ = true;
+        cv_.notify_all();
+    }
+
+    // Stops the search and waits for it. report forces bestmove even when pondering.
+    void stop(bool report) {
+        unique_lock<mutex> lock(mutex_);
+        if (!searching_)
+            return;
+        if (report)
+            report_on_stop_ = true;
+        else
+            report_on_stop_ = false;
+        stop_ = true;
+        cv_.wait(lock, [this] { return !searching_; });
+    }
+
+    bool setOption(const string& name, const string& value) {
+        stop(false);
+        if (name == "nodes") {
+            char* end = nullptr;
+            errno = 0;
+            const long long nodes = strtoll(value.c_str(), &end, 10);
+            if (end == value.c_str() || *end != '\0' || errno != 0 || nodes <= 0)
+                return false;
+            // The tree starts over, including the root's visits.
+            pool_.release(&root_.child_nodes_);
+            pool_ = NodePool(static_cast<size_t>(nodes));
+            setRoot(position_);
+        } else if (name == "prior") {
+            ctx_.prior_visits = atof(value.c_str());
+            ctx_.prior_bias = ctx_.prior_visits > 0 ? 1.0 : 0.0;
+        } else if (name == "rave") {
+            ctx_.rave_equivalence = atof(value.c_str());
+        } else if (name == "lgr") {
+            ctx_.last_good_reply = atoi(value.c_str()) != 0;
+        } else if (name == "solve") {
+            ctx_.solve_empty_cells = atoi(value.c_str());
+        } else if (name == "cache") {
+            ctx_.solved_table = nullptr;
+            if (!cache_.open(value, DEFAULT_CACHE_ENTRIES))
+                return false;
+            ctx_.solved_table = &cache_;
+        } else if (name == "bitbase") {
+            ctx_.endgame_table = nullptr;
+            if (!bitbase_.load(value.c_str()))
+                return false;
+            ctx_.endgame_table = &bitbase_;
+        } else if (name == "value") {
+            ctx_.value_function = nullptr;
+            if (!network_.load(value.c_str()))
+                return false;
+            ctx_.value_function = &network_;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+private:
+    void setRoot(const ConnectFourStateByBitSet& state) {
+        pool_.release(&root_.child_nodes_);
+        root_ = Node(state);
+        root_.expand(&ctx_);
+        ctx_.replies_.clear();
+        position_ = state;
+    }
+
+    static Node* findNode(Node* node, const ConnectFourStateByBitSet& state, int depth) {
+        if (node->getState() == state)
+            return node;
+        if (depth == 0)
+            return nullptr;
+        for (auto& child : node->child_nodes_) {
+            Node* found = findNode(&child, state, depth - 1);
+            if (found != nullptr)
+                return found;
+        }
+        return nullptr;
+    }
+
+    void run() {
+        for (;;) {
+            Limits limits;
+            {
+                unique_lock<mutex> lock(mutex_);
+                cv_.wait(lock, [this] { return has_job_ || quit_; });
+                if (quit_)
+                    return;
+                has_job_ = false;
+                limits = limits_;
+            }
+
+            int64_t count = search(limits);
+
+            lock_guard<mutex> lock(mutex_);
+            if (!stop_ || report_on_stop_)
+                report(count);
+            searching_ = false;
+            cv_.notify_all();
+        }
+    }
+
+    int64_t search(const Limits& limits) {
+        int for_draw = limits.for_draw ? 1 : 0;
+        double CCC = limits.for_draw ? 3 : 1;
+        TimeKeeper time_keeper(limits.movetime);
+        int64_t count = 0;
+        while (!stop_) {
+            if (limits.iterations > 0 && count >= limits.iterations)
+                break;
+            if (limits.movetime > 0 && (count & 63) == 0 && time_keeper.isTimeOver())
+                break;
+            int playout_player = -1;
+            root_.evaluate(for_draw, CCC, &playout_player, &ctx_);
+            pool_.trimIfNeeded(root_);
+            ++count;
+        }
+        return count;
+    }
+
+    void report(int64_t count) {
+        int best = bestActionByVisits(root_);
+        vector<int> visits(W, 0);
+        double value = 0.5;
+        for (const auto& child : root_.child_nodes_) {
+            visits[child.getAction()] = static_cast<int>(child.n_);
+            if (child.getAction() == best && child.n_ > 0)
+                value = child.getW() / child.n_;
+        }
+        ostringstream os;
+        os << "info iterations " << count << " nodes " << pool_.size() << " root_visits " << static_cast<int64_t>(root_.n_);
+        send(os.str());
+        os.str("");
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.4f", value);
+        os << "bestmove " << best + 1 << " value " << buf << " visits ";
+        for (int x = 0; x < W; ++x)
+            os << (x > 0 ? "," : "") << visits[x];
+        send(os.str());
+    }
+};
+
+// Parses the arguments of "position".
+static bool parsePositionCommand(istringstream& args, ConnectFourStateByBitSet* state) {
+    string token;
+    if (!(args >> token))
+        return false;
+    string moves;
+    if (token == "startpos") {
+        *state = ConnectFourStateByBitSet();
+    } else if (token == "rows") {
+        string rows;
+        if (!(args >> rows) || !parseRows(rows, state))
+            return false;
+    } else {
+        return parseMoves(token, state) && !(args >> token);
+    }
+    if (args >> token) {
+        if (token != "moves" || !(args >> moves))
+            return false;
+        for (const char c : moves) {
+            int action = c - '1';
+            if (action < 0 || action >= W || state->isDone())
+                return false;
+            auto legal_actions = state->legalActions();
+            if (find(legal_actions.begin(), legal_actions.end(), action) == legal_actions.end())
+                return false;
+            state->advance(action);
+        }
+    }
+    return true;
+}
+
+int main() {
+    ios::sync_with_stdio(false);
+    Engine engine;
+    string line;
+    while (getline(cin, line)) {
+        istringstream args(line);
+        string command;
+        if (!(args >> command))
+            continue;
+        if (command == "quit") {
+            break;
+        } else if (command == "isready") {
+            send("readyok");
+        } else if (command == "newgame") {
+            engine.newGame();
+        } else if (command == "position") {
+            ConnectFourStateByBitSet state;
+            if (parsePositionCommand(args, &state))
+                engine.setPosition(state);
+            else
+                send("error invalid position");
+        } else if (command == "go" || command == "ponder") {
+            Limits limits;
+            limits.ponder = command == "ponder";
+            string token;
+            while (args >> token) {
+                if (token == "iterations" && args >> limits.iterations) {
+                } else if (token == "movetime" && args >> limits.movetime) {
+                } else if (token == "infinite") {
+                    limits.iterations = limits.movetime = 0;
+                } else if (token == "draw") {
+                    limits.for_draw = true;
+                } else {
+                    send("error unknown go option: " + token);
+                }
+            }
+            engine.go(limits);
+        } else if (command == "stop") {
+            engine.stop(true);
+        } else if (command == "setoption") {
+            string name, value;
+            if (!(args >> name >> value) || !engine.setOption(name, value))
+                send("error invalid option");
+        } else {
+            send("error unknown command: " + command);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,186 @@
+// Game session shared by the WASM bindings and the native server.
+#pragma once
+#include "02_BitBoard.h"
+#include "ntuple.h"
+
+// Default upper bound of search tree nodes kept by a game: 64MB of nodes.
+constexpr size_t DEFAULT_NODE_BUDGET = montecarlo_bit::NodePool::nodesForBytes(64 << 20);
+
+class Game {
+private:
+    State state;
+    montecarlo_bit::Node node;
+    montecarlo_bit::NodePool pool;
+    montecarlo_bit::SearchContext ctx;
+    montecarlo_bit::NTupleNetwork value_network;
+
+public:
+    Game() : state(), node(ConnectFourStateByBitSet(state)), pool(DEFAULT_NODE_BUDGET) {
+        ctx.pool = &pool;
+    }
+
+    Game(const Game&) = delete;
+    Game& operator=(const Game&) = delete;
+
+    int getTurn() const { return state.is_first_ ? 0 : 1; }
+
+    bool isDone() const { return state.isDone(); }
+
+    int getWinner() const {
+        auto w = state.getWinningStatus();
+        switch (w) {
+        case WinningStatus::WIN:
+        case WinningStatus::LOSE:
+            return state.is_first_;
+        case WinningStatus::DRAW: return -1;
+        default: return -1;  // Not happend.
+        }
+    }
+
+    void start() {
+        state = State();
+        updateState();
+    }
+
+    void getBoard(intptr_t ptr) {
+        const int* p1;
+        const int* p2;
+        if (state.is_first_) {
+            p1 = &state.my_board_[0][0];
+            p2 = &state.enemy_board_[0][0];
+        } else {
+            p1 = &state.enemy_board_[0][0];
+            p2 = &state.my_board_[0][0];
+        }
+        unsigned char *dst = reinterpret_cast<unsigned char*>(ptr);
+        for (int i = 0; i < 6; ++i) {
+            for (int j = 0; j < 7; ++j) {
+                *dst++ = (*p1++) + ((*p2++) << 1);
+            }
+        }
+    }
+
+    int getLegalActions() const {
+        auto legal_actions = state.legalActions();
+        int result = 0;
+        for (const auto &action : legal_actions) {
+            result |= 1 << action;
+        }
+        return result;
+    }
+
+    void playHand(int action) {
+        state.advance(action);
+        updateState();
+    }
+
+    int searchHand(int time_threshold, bool for_draw_) {
+        int for_draw = for_draw_ ? 1 : 0;
+        double CCC = for_draw ? 3 : 1;
+        return mctsActionBitWithTimeThreshold(state, time_threshold, for_draw ? 1 : 0, CCC);
+    }
+
+    // Searches a fresh tree with a fixed number of iterations. Sequential halving
+    // at the root makes better use of small budgets than UCB1. The search has its
+    // own node pool and reply table, so the kept tree is left as it is.
+    int searchHandWithIterations(int iterations, bool for_draw_, bool sequential_halving) {
+        int for_draw = for_draw_ ? 1 : 0;
+        double CCC = for_draw ? 3 : 1;
+        auto policy = sequential_halving ? montecarlo_bit::RootPolicy::SEQUENTIAL_HALVING : montecarlo_bit::RootPolicy::UCB;
+        montecarlo_bit::NodePool search_pool(pool.capacity());
+        montecarlo_bit::SearchContext search_ctx;
+        search_ctx.pool = &search_pool;
+        search_ctx.rave_equivalence = ctx.rave_equivalence;
+        search_ctx.prior_visits = ctx.prior_visits;
+        search_ctx.prior_bias = ctx.prior_bias;
+        search_ctx.last_good_reply = ctx.last_good_reply;
+        search_ctx.solve_empty_cells = ctx.solve_empty_cells;
+        search_ctx.solved_table = ctx.solved_table;
+        search_ctx.endgame_table = ctx.endgame_table;
+        search_ctx.value_function = ctx.value_function;
+        return montecarlo_bit::mctsActionBitWithIterations(ConnectFourStateByBitSet(state), iterations, for_draw, CCC, &search_ctx, policy);
+    }
+
+    // Runs count more iterations on the tree of the current position.
+    void proceed(int count, bool for_draw_) {
+        int for_draw = for_draw_ ? 1 : 0;
+        double CCC = for_draw ? 3 : 1;
+        for (int i = 0; i < count; ++i) {
+            int playout_player = -1;
+            node.evaluate(for_draw, CCC, &playout_player, &ctx);
+            pool.trimIfNeeded(node);
+        }
+    }
+
+    // Most visited column of the current tree, or -1 if nothing was searched.
+    int bestAction() const {
+        return montecarlo_bit::bestActionByVisits(node);
+    }
+
+    size_t getNodeCount() const { return pool.size(); }
+
+    void proceedMcts(int count, bool for_draw_, intptr_t ptr) {
+        proceed(count, for_draw_);
+
+        int32_t* dst = reinterpret_cast<int32_t*>(ptr);
+        for (int i = 0; i < W; ++i)
+            dst[i] = 0;
+        for (const auto& child : node.child_nodes_)
+            dst[child.getAction()] = child.n_;
+    }
+
+    // Enables RAVE in the assist search; 0 disables it.
+    void setRaveEquivalence(double equivalence) {
+        ctx.rave_equivalence = equivalence;
+    }
+
+    // Uses the static evaluation as a prior in the assist search; 0 disables it.
+    void setPrior(double visits, double bias) {
+        ctx.prior_visits = visits;
+        ctx.prior_bias = bias;
+    }
+
+    // Uses last-good-reply playouts in the assist search.
+    void setLastGoodReply(bool enabled) {
+        ctx.last_good_reply = enabled;
+    }
+
+    // Solves leaves with at most empty_cells empty cells instead of playing out; 0 disables it.
+    void setSolveEmptyCells(int empty_cells) {
+        ctx.solve_empty_cells = empty_cells;
+    }
+
+    // Shares solved positions with other games through table (native only).
+    void setSolvedTable(montecarlo_bit::SolvedTable* table) {
+        ctx.solved_table = table;
+    }
+
+    // Evaluates leaves with the n-tuple network in bytes (a weight file written by
+    // ntrain) instead of random playouts. Empty or invalid bytes go back to playouts.
+    bool loadValueWeights(const std::string& bytes) {
+        ctx.value_function = nullptr;
+        if (!value_network.loadBuffer(bytes.data(), bytes.size()))
+            return false;
+        ctx.value_function = &value_network;
+        return true;
+    }
+
+    // Limits the search tree to max_nodes nodes and starts it over. Returns
+    // false and keeps the current budget if max_nodes is not positive.
+    bool setNodeBudget(int max_nodes) {
+        if (max_nodes <= 0)
+            return false;
+        pool.release(&node.child_nodes_);
+        pool = montecarlo_bit::NodePool(max_nodes);
+        node.expand(&ctx);
+        return true;
+    }
+
+private:
+    void updateState() {
+        pool.release(&node.child_nodes_);
+        ctx.replies_.clear();
+        node = montecarlo_bit::Node(ConnectFourStateByBitSet(state));
+        node.expand(&ctx);
+    }
+};
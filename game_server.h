@@ -0,0 +1,335 @@
+// Hosts many Game sessions and runs their move searches on a shared pool of
+// worker threads. Searches are cut into slices of a fixed number of
+// iterations. Pending searches wait in one priority queue shared by all
+// workers, and an idle worker runs a slice for the nearest deadline.
+#pragma once
+#include "game.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+struct GameServerConfig {
+    int threads = 0;                      // 0 for all cores
+    size_t node_budget_per_session = 1 << 16;
+    int slice_iterations = 500;           // iterations per scheduling slice
+    int solve_empty_cells = 0;            // solve leaves with at most this many empty cells
+    montecarlo_bit::SolvedTable* solved_table = nullptr;  // shared by all sessions
+
+    // The node budget must be accepted by Game::setNodeBudget, and a slice
+    // must run at least one iteration.
+    bool isValid() const {
+        return node_budget_per_session > 0 && node_budget_per_session <= static_cast<size_t>(INT_MAX) && slice_iterations > 0;
+    }
+};
+
+struct GameServerMetrics {
+    size_t sessions = 0;
+    size_t pending_requests = 0;
+    size_t nodes = 0;                     // tree nodes held by all sessions
+    uint64_t iterations = 0;
+    uint64_t slices = 0;
+    uint64_t completed_requests = 0;
+    uint64_t canceled_requests = 0;
+    uint64_t deadline_misses = 0;
+    uint64_t total_latency_us = 0;        // over completed requests
+    uint64_t max_latency_us = 0;
+};
+
+class GameServer {
+public:
+    using SessionId = uint64_t;
+    // Receives the chosen column, or -1 when the request was canceled.
+    using MoveCallback = std::function<void(SessionId, int)>;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Session {
+        explicit Session(SessionId id_) : id(id_) {}
+
+        const SessionId id;
+        std::mutex mutex;
+        Game game;
+        bool closed = false;
+        uint64_t request = 0;             // incremented for every request
+        bool searching = false;
+        bool for_draw = false;
+        Clock::time_point requested_at;
+        Clock::time_point deadline;
+        Clock::duration slice_time{};     // duration of the last slice
+        MoveCallback callback;
+    };
+
+    struct Entry {
+        Clock::time_point deadline;
+        uint64_t request;
+        std::shared_ptr<Session> session;
+
+        bool operator<(const Entry& other) const { return deadline > other.deadline; }
+    };
+
+    GameServerConfig config_;
+    std::mutex sessions_mutex_;
+    std::unordered_map<SessionId, std::shared_ptr<Session>> sessions_;
+    SessionId next_id_ = 1;
+
+    std::mutex queue_mutex_;
+    std::condition_variable queue_cv_;
+    std::vector<Entry> queue_;            // min-heap on deadline
+    bool quit_ = false;                   // guarded by queue_mutex_
+
+    std::atomic<size_t> nodes_{0};
+    std::atomic<uint64_t> iterations_{0};
+    std::atomic<uint64_t> slices_{0};
+    std::atomic<uint64_t> completed_{0};
+    std::atomic<uint64_t> canceled_{0};
+    std::atomic<uint64_t> misses_{0};
+    std::atomic<uint64_t> total_latency_us_{0};
+    std::atomic<uint64_t> max_latency_us_{0};
+
+    std::vector<std::thread> workers_;
+
+    std::shared_ptr<Session> find(SessionId id) {
+        std::lock_guard<std::mutex> lock(sessions_mutex_);
+        auto it = sessions_.find(id);
+        return it != sessions_.end() ? it->second : nullptr;
+    }
+
+    void enqueue(Entry entry) {
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex_);
+            queue_.push_back(std::move(entry));
+            std::push_heap(queue_.begin(), queue_.end());
+        }
+        queue_cv_.notify_one();
+    }
+
+    // Worker thread: takes the entry with the earliest deadline until the server stops.
+    void runWorker() {
+        for (;;) {
+            Entry entry;
+            {
+                std::unique_lock<std::mutex> lock(queue_mutex_);
+                queue_cv_.wait(lock, [this] { return quit_ || !queue_.empty(); });
+                if (quit_)
+                    return;
+                std::pop_heap(queue_.begin(), queue_.end());
+                entry = std::move(queue_.back());
+                queue_.pop_back();
+            }
+            runSlice(std::move(entry));
+        }
+    }
+
+    // Runs one slice of a request and queues it again unless its time is up.
+    void runSlice(Entry entry) {
+        Session& session = *entry.session;
+        std::unique_lock<std::mutex> lock(session.mutex);
+        if (session.closed || !session.searching || session.request != entry.request)
+            return;
+
+        auto start = Clock::now();
+        size_t nodes_before = session.game.getNodeCount();
+        session.game.proceed(config_.slice_iterations, session.for_draw);
+        auto now = Clock::now();
+        nodes_ += session.game.getNodeCount() - nodes_before;
+        session.slice_time = now - start;
+        iterations_ += config_.slice_iterations;
+        ++slices_;
+
+        if (now + session.slice_time < session.deadline) {
+            lock.unlock();
+            enqueue(std::move(entry));
+            return;
+        }
+
+        int action = session.game.bestAction();
+        if (action < 0) {
+            // Nothing was searched in the kept tree, e.g. the node budget left no
+            // room for the root's children. -1 means canceled to the callback, so
+            // run a short search on a fresh tree, which always gives a move.
+            action = session.game.searchHandWithIterations(config_.slice_iterations, session.for_draw, false);
+        }
+        session.searching = false;
+        MoveCallback callback = std::move(session.callback);
+        session.callback = nullptr;
+        auto latency = std::chrono::duration_cast<std::chrono::microseconds>(now - session.requested_at).count();
+        if (now > session.deadline)
+            ++misses_;
+        ++completed_;
+        total_latency_us_ += latency;
+        uint64_t max_latency = max_latency_us_;
+        while (static_cast<uint64_t>(latency) > max_latency && !max_latency_us_.compare_exchange_weak(max_latency, latency)) {
+        }
+        lock.unlock();
+        if (callback)
+            callback(session.id, action);
+    }
+
+    // Cancels the pending request of a locked session and returns its callback.
+    MoveCallback cancelLocked(Session& session) {
+        if (!session.searching)
+            return nullptr;
+        session.searching = false;
+        ++session.request;
+        ++canceled_;
+        MoveCallback callback = std::move(session.callback);
+        session.callback = nullptr;
+        return callback;
+    }
+
+    // Runs f on the game of a locked session while keeping the node metric in sync.
+    template <class F>
+    void updateGame(Session& session, F f) {
+        size_t nodes_before = session.game.getNodeCount();
+        f(session.game);
+        nodes_ += session.game.getNodeCount() - nodes_before;
+    }
+
+public:
+    explicit GameServer(const GameServerConfig& config = GameServerConfig()) : config_(config) {
+        int threads = config.threads > 0 ? config.threads : std::max(1u, std::thread::hardware_concurrency());
+        for (int i = 0; i < threads; ++i)
+            workers_.emplace_back(&GameServer::runWorker, this);
+    }
+
+    GameServer(const GameServer&) = delete;
+    GameServer& operator=(const GameServer&) = delete;
+
+    // Stops the workers before the sessions go away. Pending requests are dropped.
+    ~GameServer() {
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex_);
+            quit_ = true;
+        }
+        queue_cv_.notify_all();
+        for (auto& t : workers_)
+            t.join();
+    }
+
+    int threadCount() const { return static_cast<int>(workers_.size()); }
+
+    // Starts a new game and returns its session, or 0 if the configuration is
+    // not valid (see GameServerConfig::isValid).
+    SessionId createSession() {
+        if (!config_.isValid())
+            return 0;
+        std::lock_guard<std::mutex> lock(sessions_mutex_);
+        SessionId id = next_id_++;
+        auto session = std::make_shared<Session>(id);
+        updateGame(*session, [this](Game& game) {
+            game.setNodeBudget(static_cast<int>(config_.node_budget_per_session));
+            game.setSolveEmptyCells(config_.solve_empty_cells);
+            game.setSolvedTable(config_.solved_table);
+            game.start();
+        });
+        sessions_.emplace(id, std::move(session));
+        return id;
+    }
+
+    // Ends a session. A pending request is canceled.
+    bool closeSession(SessionId id) {
+        std::shared_ptr<Session> session;
+        {
+            std::lock_guard<std::mutex> lock(sessions_mutex_);
+            auto it = sessions_.find(id);
+            if (it == sessions_.end())
+                return false;
+            session = std::move(it->second);
+            sessions_.erase(it);
+        }
+        MoveCallback callback;
+        {
+            std::lock_guard<std::mutex> lock(session->mutex);
+            callback = cancelLocked(*session);
+            session->closed = true;
+            nodes_ -= session->game.getNodeCount();
+        }
+        if (callback)
+            callback(id, -1);
+        return true;
+    }
+
+    // Plays a column. A pending move request for the old position is canceled.
+    bool playHand(SessionId id, int action) {
+        auto session = find(id);
+        if (!session)
+            return false;
+        MoveCallback callback;
+        {
+            std::lock_guard<std::mutex> lock(session->mutex);
+            Game& game = session->game;
+            if (game.isDone() || action < 0 || action >= W || (game.getLegalActions() & (1 << action)) == 0)
+                return false;
+            callback = cancelLocked(*session);
+            updateGame(*session, [action](Game& g) { g.playHand(action); });
+        }
+        if (callback)
+            callback(id, -1);
+        return true;
+    }
+
+    // Searches the current position until time_threshold ms from now, then
+    // calls callback with the chosen column on a worker thread.
+    bool requestMove(SessionId id, int64_t time_threshold, bool for_draw, MoveCallback callback) {
+        auto session = find(id);
+        if (!session)
+            return false;
+        Entry entry;
+        {
+            std::lock_guard<std::mutex> lock(session->mutex);
+            if (session->game.isDone() || session->searching)
+                return false;
+            auto now = Clock::now();
+            session->searching = true;
+            session->for_draw = for_draw;
+            session->requested_at = now;
+            session->deadline = now + std::chrono::milliseconds(time_threshold);
+            session->callback = std::move(callback);
+            entry.deadline = session->deadline;
+            entry.request = ++session->request;
+            entry.session = session;
+        }
+        enqueue(std::move(entry));
+        return true;
+    }
+
+    // Runs f(const Game&) under the session lock, e.g. to read the board.
+    template <class F>
+    bool withGame(SessionId id, F f) {
+        auto session = find(id);
+        if (!session)
+            return false;
+        std::lock_guard<std::mutex> lock(session->mutex);
+        f(static_cast<const Game&>(session->game));
+        return true;
+    }
+
+    GameServerMetrics metrics() {
+        GameServerMetrics m;
+        {
+            std::lock_guard<std::mutex> lock(sessions_mutex_);
+            m.sessions = sessions_.size();
+        }
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex_);
+            m.pending_requests = queue_.size();
+        }
+        m.nodes = nodes_;
+        m.iterations = iterations_;
+        m.slices = slices_;
+        m.completed_requests = completed_;
+        m.canceled_requests = canceled_;
+        m.deadline_misses = misses_;
+        m.total_latency_us = total_latency_us_;
+        m.max_latency_us = max_latency_us_;
+        return m;
+    }
+};
@@ -0,0 +1,135 @@
+// Load test for GameServer: keeps many sessions playing against a random
+// opponent and prints throughput and latency metrics.
+#include "game_server.h"
+#include "solved_cache.h"
+#include <iostream>
+#include <string.h>
+
+using namespace std;
+
+struct LoadTest {
+    GameServer* server;
+    int64_t time_threshold;
+    atomic<bool> stopping{false};
+    atomic<uint64_t> games{0};
+    atomic<uint64_t> moves{0};
+    atomic<int> active{0};
+
+    void startGame() {
+        ++active;
+        auto id = server->createSession();
+        requestMove(id);
+    }
+
+    void requestMove(GameServer::SessionId id) {
+        if (stopping || !server->requestMove(id, time_threshold, false, [this](GameServer::SessionId id, int action) { onMove(id, action); })) {
+            server->closeSession(id);
+            --active;
+        }
+    }
+
+    bool isDone(GameServer::SessionId id) {
+        bool done = true;
+        server->withGame(id, [&](const Game& game) { done = game.isDone(); });
+        return done;
+    }
+
+    void onMove(GameServer::SessionId id, int action) {
+        if (action < 0)
+            return;
+        ++moves;
+        server->playHand(id, action);
+        if (!isDone(id)) {
+            int legal = 0;
+            server->withGame(id, [&](const Game& game) { legal = game.getLegalActions(); });
+            int actions[W];
+            int count = 0;
+            for (int x = 0; x < W; ++x) {
+                if (legal & (1 << x))
+                    actions[count++] = x;
+            }
+            server->playHand(id, actions[mt_for_action() % count]);
+        }
+        if (isDone(id)) {
+            ++games;
+            server->closeSession(id);
+            --active;
+            if (!stopping)
+                startGame();
+            return;
+        }
+        requestMove(id);
+    }
+};
+
+int main(int argc, char* argv[]) {
+    int sessions = 1000;
+    int64_t time_threshold = 100;
+    int seconds = 10;
+    GameServerConfig config;
+    // Many sessions at the server default would need gigabytes of tree nodes;
+    // 1000 sessions of 4096 nodes fit in about 400MB.
+    config.node_budget_per_session = 1 << 12;
+    const char* cache_path = nullptr;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "-s") == 0) {
+            sessions = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-t") == 0) {
+            time_threshold = atoll(argv[i + 1]);
+        } else if (strcmp(argv[i], "-d") == 0) {
+            seconds = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-j") == 0) {
+            config.threads = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-m") == 0) {
+            config.node_budget_per_session = atoll(argv[i + 1]);
+        } else if (strcmp(argv[i], "-e") == 0) {
+            config.solve_empty_cells = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-c") == 0) {
+            cache_path = argv[i + 1];
+        } else {
+            cerr << "Usage: gameserver [-s sessions] [-t ms per move] [-d seconds] [-j threads] [-m nodes per session (default 4096)]"
+                 << " [-e solve empty cells] [-c solved cache file]" << endl;
+            return 1;
+        }
+    }
+    if (!config.isValid()) {
+        cerr << "Invalid node budget: -m must be between 1 and " << INT_MAX << endl;
+        return 1;
+    }
+    montecarlo_bit::SolvedCache cache;
+    if (cache_path != nullptr) {
+        if (!cache.open(cache_path, 1 << 22)) {
+            cerr << "Cannot open cache: " << cache_path << endl;
+            return 1;
+        }
+        config.solved_table = &cache;
+    }
+
+    GameServer server(config);
+    LoadTest test;
+    test.server = &server;
+    test.time_threshold = time_threshold;
+    for (int i = 0; i < sessions; ++i)
+        test.startGame();
+
+    auto start = chrono::steady_clock::now();
+    this_thread::sleep_for(chrono::seconds(seconds));
+    test.stopping = true;
+    while (test.active > 0)
+        this_thread::sleep_for(chrono::milliseconds(10));
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    auto m = server.metrics();
+    printf("threads %d, sessions %d, %lld ms per move, %.1f s\n", server.threadCount(), sessions, (long long)time_threshold, elapsed);
+    printf("games %llu, moves %llu (%.1f/s), iterations %llu (%.0f/s), slices %llu\n",
+           (unsigned long long)test.games, (unsigned long long)test.moves, test.moves / elapsed,
+           (unsigned long long)m.iterations, m.iterations / elapsed, (unsigned long long)m.slices);
+    printf("latency avg %.1f ms, max %.1f ms, deadline misses %llu, canceled %llu\n",
+           m.completed_requests > 0 ? m.total_latency_us / 1000.0 / m.completed_requests : 0.0,
+           m.max_latency_us / 1000.0, (unsigned long long)m.deadline_misses, (unsigned long long)m.canceled_requests);
+    if (cache.isOpen()) {
+        printf("solved cache hits %llu, misses %llu, entries %llu\n", (unsigned long long)cache.hits(),
+               (unsigned long long)cache.misses(), (unsigned long long)cache.count());
+    }
+    return 0;
+}
@@ -0,0 +1,233 @@
+// Trains an n-tuple network by TD self-play and writes its weight file.
+//
+// Each self-play move updates the value of the position toward the best
+// value among its moves (TD(0), negamax form), then plays that move or, with
+// probability epsilon, a random non-losing one. Every -r games the network
+// is scored on a fixed set of solved positions.
+//
+// --eval FILE scores a trained network against averages of random
+// playouts on the same positions, with the time per evaluation.
+#include "ntuple.h"
+#include "parallel_solver.h"
+#include <iostream>
+#include <string.h>
+
+using namespace montecarlo_bit;
+using namespace std;
+
+struct Options {
+    int64_t games = 100000;
+    int tuples = 32;
+    int length = 8;
+    double rate = 0.5;
+    double epsilon = 0.1;
+    uint32_t seed = 1;
+    int64_t report = 10000;
+    int test_positions = 500;
+    const char* init_path = nullptr;
+    const char* out_path = nullptr;
+    const char* eval_path = nullptr;
+};
+
+struct TestPosition {
+    ConnectFourStateByBitSet state;
+    int result;  // for the side to move: 1 win, -1 loss
+};
+
+// Value for the side to move in [-1, 1], exact when the next move decides.
+static double valueOf(const NTupleNetwork& network, const ConnectFourStateByBitSet& state) {
+    if (state.isDone())
+        return 0;  // only a full board can end the game here
+    if (state.canWinNext())
+        return 1;
+    if (state.nonLosingMoves() == 0)
+        return -1;
+    return network.value(state.getMyBoard(), state.getAllBoard());
+}
+
+// Column of the index-th cell of moves, counting from the left.
+static int columnOf(ConnectFourStateByBitSet::Bits moves, int index) {
+    for (int x = 0; x < W; ++x) {
+        if ((moves & BoardGeometry<H, W>::columnBits(x)) != 0 && index-- == 0)
+            return x;
+    }
+    return -1;
+}
+
+static void selfPlay(NTupleNetwork* network, const Options& options, mt19937* random) {
+    ConnectFourStateByBitSet state;
+    uniform_real_distribution<double> uniform(0, 1);
+    while (!state.isDone() && !state.canWinNext()) {
+        const auto moves = state.nonLosingMoves();
+        if (moves == 0)
+            break;
+        double best = -2;
+        int best_action = -1;
+        for (int x = 0; x < W; ++x) {
+            if ((moves & BoardGeometry<H, W>::columnBits(x)) == 0)
+                continue;
+            ConnectFourStateByBitSet next = state;
+            next.advance(x);
+            const double value = -valueOf(*network, next);
+            if (value > best) {
+                best = value;
+                best_action = x;
+            }
+        }
+        network->update(state.getMyBoard(), state.getAllBoard(), best, options.rate);
+        int action = best_action;
+        if (uniform(*random) < options.epsilon)
+            action = columnOf(moves, (*random)() % bitCount(moves));
+        state.advance(action);
+    }
+}
+
+// Positions from random games with 12 to 26 empty cells, solved exactly.
+// Positions decided by the next move are skipped since no evaluator is
+// needed there, and so are draws: an evaluator is scored by whether its
+// value has the sign of the result.
+static vector<TestPosition> makeTestSet(int count, uint32_t seed) {
+    mt19937 random(seed);
+    ParallelSolver solver(64 << 20);
+    vector<TestPosition> positions;
+    while (static_cast<int>(positions.size()) < count) {
+        const int empty_cells = 12 + random() % 15;
+        ConnectFourStateByBitSet state;
+        while (!state.isDone() && H * W - bitCount(state.getAllBoard()) > empty_cells) {
+            const auto actions = state.legalActions();
+            state.advance(actions[random() % actions.size()]);
+        }
+        if (state.isDone() || state.canWinNext() || state.nonLosingMoves() == 0)
+            continue;
+        const int result = solver.solve(state, 1);
+        if (result != 0)
+            positions.emplace_back(TestPosition{state, result});
+    }
+    return positions;
+}
+
+static double accuracy(const NTupleNetwork& network, const vector<TestPosition>& positions) {
+    int correct = 0;
+    for (const auto& position : positions)
+        correct += valueOf(network, position.state) * position.result > 0;
+    return static_cast<double>(correct) / positions.size();
+}
+
+// Mean result of random games for the side to move, in [-1, 1].
+static double playoutValue(const ConnectFourStateByBitSet& root, int playouts) {
+    int total = 0;
+    for (int i = 0; i < playouts; ++i) {
+        ConnectFourStateByBitSet state = root;
+        while (!state.isDone())
+            state.advance(randomActionBit(state));
+        if (state.getWinningStatus() == WinningStatus::LOSE)
+            total += state.isFirst() == root.isFirst() ? -1 : 1;
+    }
+    return static_cast<double>(total) / playouts;
+}
+
+static void evaluate(const NTupleNetwork& network, const vector<TestPosition>& positions) {
+    printf("%-16s %9s %14s\n", "evaluator", "accuracy", "us/position");
+    auto start = chrono::steady_clock::now();
+    const double network_accuracy = accuracy(network, positions);
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    printf("%-16s %9.3f %14.3f\n", "n-tuple", network_accuracy, elapsed * 1e6 / positions.size());
+    for (const int playouts : {1, 4, 16, 64, 256, 1024}) {
+        int correct = 0;
+        start = chrono::steady_clock::now();
+        for (const auto& position : positions)
+            correct += playoutValue(position.state, playouts) * position.result > 0;
+        elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        string name = to_string(playouts) + " playouts";
+        printf("%-16s %9.3f %14.3f\n", name.c_str(), static_cast<double>(correct) / positions.size(), elapsed * 1e6 / positions.size());
+        fflush(stdout);
+    }
+}
+
+static void usage() {
+    cerr << "Usage: ntrain [options]\n"
+         << "  -g N        self-play games (default 100000)\n"
+         << "  -t N        tuples in a new network (default 32)\n"
+         << "  -n N        cells per tuple, at most 10 (default 8)\n"
+         << "  -a RATE     learning rate (default 0.5)\n"
+         << "  -e EPSILON  probability of a random move (default 0.1)\n"
+         << "  -s SEED     random seed for tuples and games (default 1)\n"
+         << "  -r N        score on the test positions every N games (default 10000)\n"
+         << "  -p N        test positions (default 500)\n"
+         << "  -i FILE     continue training from a weight file\n"
+         << "  -o FILE     write the weights to FILE after every report\n"
+         << "  --eval FILE score FILE against random playouts instead of training\n";
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (strcmp(arg, "-g") == 0 && has_value) {
+            options.games = atoll(argv[++i]);
+        } else if (strcmp(arg, "-t") == 0 && has_value) {
+            options.tuples = atoi(argv[++i]);
+        } else if (strcmp(arg, "-n") == 0 && has_value) {
+            options.length = atoi(argv[++i]);
+        } else if (strcmp(arg, "-a") == 0 && has_value) {
+            options.rate = atof(argv[++i]);
+        } else if (strcmp(arg, "-e") == 0 && has_value) {
+            options.epsilon = atof(argv[++i]);
+        } else if (strcmp(arg, "-s") == 0 && has_value) {
+            options.seed = atoi(argv[++i]);
+        } else if (strcmp(arg, "-r") == 0 && has_value) {
+            options.report = atoll(argv[++i]);
+        } else if (strcmp(arg, "-p") == 0 && has_value) {
+            options.test_positions = atoi(argv[++i]);
+        } else if (strcmp(arg, "-i") == 0 && has_value) {
+            options.init_path = argv[++i];
+        } else if (strcmp(arg, "-o") == 0 && has_value) {
+            options.out_path = argv[++i];
+        } else if (strcmp(arg, "--eval") == 0 && has_value) {
+            options.eval_path = argv[++i];
+        } else {
+            usage();
+            return 1;
+        }
+    }
+    if (options.report <= 0 || options.test_positions <= 0) {
+        usage();
+        return 1;
+    }
+
+    NTupleNetwork network;
+    const char* load_path = options.eval_path != nullptr ? options.eval_path : options.init_path;
+    if (load_path != nullptr) {
+        if (!network.load(load_path)) {
+            cerr << "Cannot load weights: " << load_path << endl;
+            return 1;
+        }
+    } else {
+        network.init(options.tuples, options.length, options.seed);
+    }
+    printf("%zu tuples, %zu weights\n", network.tupleCount(), network.weightCount());
+    const auto test_set = makeTestSet(options.test_positions, 12345);
+    if (options.eval_path != nullptr) {
+        evaluate(network, test_set);
+        return 0;
+    }
+
+    mt19937 random(options.seed);
+    printf("%10s %9s %10s\n", "games", "accuracy", "games/s");
+    printf("%10d %9.3f %10s\n", 0, accuracy(network, test_set), "-");
+    auto start = chrono::steady_clock::now();
+    for (int64_t game = 1; game <= options.games; ++game) {
+        selfPlay(&network, options, &random);
+        if (game % options.report == 0 || game == options.games) {
+            double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            printf("%10lld %9.3f %10.0f\n", (long long)game, accuracy(network, test_set), game / elapsed);
+            fflush(stdout);
+            if (options.out_path != nullptr && !network.save(options.out_path)) {
+                cerr << "Cannot write: " << options.out_path << endl;
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
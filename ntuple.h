@@ -0,0 +1,336 @@
+// n-tuple ネットワークによる局面の評価関数
+//
+// 盤上のいくつかのマスの組(タプル)ごとに、そのマスの状態(空き・手番の石・相手の石)の
+// すべての組み合わせの重みを持つ。局面の値は、各タプルの今の状態の重みと、左右を反転した
+// 盤面での重みの和をtanhに通したもの。重みの学習はntrain.cppで行う。
+//
+// マスの状態は3進数の1桁とし、タプルのマスの状態を並べた数を重みの添字にする。
+// 添字は列ごとの表を引いて足して求める。BMI2があればpextでタプルのマスをまとめて抜き出し、
+// AVX2があれば重みの和をgatherでまとめて求める。
+//
+// ファイル形式(数値はすべてリトルエンディアン):
+//   "C4NT" バージョン(1) H(1) W(1) タプル数(1) 重みの倍率(float 4) 予約(4)
+//   タプルごとに: マス数(1) マスのビット位置(各1、昇順)
+//   重み (int16、タプルの順に3^マス数個ずつ。倍率を掛けると元の値になる)
+// ネイティブでもWASMでも、読み込んだバイト列をloadBufferに渡せば使える。
+#pragma once
+#include "02_BitBoard.h"
+#include <cstring>
+#include <fstream>
+#include <istream>
+#include <iterator>
+#include <ostream>
+#if defined(__BMI2__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace montecarlo_bit
+{
+    template <class BitState>
+    class BasicNTupleNetwork : public BasicValueFunction<BitState>
+    {
+    private:
+        static_assert(sizeof(typename BitState::Bits) <= sizeof(uint64_t), "board does not fit in 64 bits");
+
+        static constexpr int H = BitState::H;
+        static constexpr int W = BitState::W;
+        static constexpr char MAGIC[4] = {'C', '4', 'N', 'T'};
+        static constexpr uint8_t VERSION = 1;
+        static constexpr size_t HEADER_BYTES = 16;
+
+    public:
+        static constexpr int MAX_LENGTH = 10;  // 1つのタプルのマス数の上限。3^10個の重みになる
+        static constexpr int MAX_TUPLES = 255;
+
+    private:
+        static constexpr uint64_t COLUMN_BITS = (uint64_t(1) << H) - 1;
+        static_assert(H <= 12, "column tables would be too large");
+
+        // タプルのうち1つの列に入っているマス
+        struct Segment
+        {
+            int shift;      // 列の最下段のビット位置
+            uint32_t table; // column_tables_の中の位置。列の石のビットから添字に足す値を引く
+        };
+
+        struct Tuple
+        {
+            std::vector<int> cells; // ビット位置の昇順
+            uint64_t mask;
+            uint32_t offset; // weights_の中の最初の重みの位置
+            std::vector<Segment> segments;
+        };
+
+        std::vector<Tuple> tuples_;
+        std::vector<float> weights_;
+        std::vector<uint32_t> column_tables_;
+        uint32_t ternary_[1 << MAX_LENGTH]; // iビット目が立っていれば3^iを足した値
+
+        static uint32_t power3(int n)
+        {
+            uint32_t result = 1;
+            for (int i = 0; i < n; i++)
+                result *= 3;
+            return result;
+        }
+
+        static uint64_t mirror(uint64_t board)
+        {
+            constexpr uint64_t column = (uint64_t(1) << (H + 1)) - 1;
+            uint64_t result = 0;
+            for (int x = 0; x < W; x++)
+                result |= ((board >> (x * (H + 1))) & column) << ((W - 1 - x) * (H + 1));
+            return result;
+        }
+
+        // タプルのマスの状態から重みの添字(先頭からの位置)を求める
+        uint32_t index(uint64_t my, uint64_t opponent, const Tuple &tuple) const
+        {
+#if defined(__BMI2__)
+            return this->ternary_[_pext_u64(my, tuple.mask)] + 2 * this->ternary_[_pext_u64(opponent, tuple.mask)];
+#else
+            uint32_t result = 0;
+            for (const auto &segment : tuple.segments)
+            {
+                const uint32_t *table = &this->column_tables_[segment.table];
+                result += table[(my >> segment.shift) & COLUMN_BITS] + 2 * table[(opponent >> segment.shift) & COLUMN_BITS];
+            }
+            return result;
+#endif
+        }
+
+        void addTuple(std::vector<int> cells)
+        {
+            std::sort(cells.begin(), cells.end());
+            Tuple tuple{cells, 0, static_cast<uint32_t>(this->weights_.size()), {}};
+            for (const int cell : cells)
+                tuple.mask |= uint64_t(1) << cell;
+            // i番目のマスは3進数のi桁目
+            for (size_t i = 0; i < cells.size(); i++)
+            {
+                const int shift = cells[i] / (H + 1) * (H + 1);
+                if (tuple.segments.empty() || tuple.segments.back().shift != shift)
+                {
+                    tuple.segments.emplace_back(Segment{shift, static_cast<uint32_t>(this->column_tables_.size())});
+                    this->column_tables_.resize(this->column_tables_.size() + (COLUMN_BITS + 1), 0);
+                }
+                uint32_t *table = &this->column_tables_[tuple.segments.back().table];
+                for (uint32_t bits = 0; bits <= COLUMN_BITS; bits++)
+                {
+                    if ((bits >> (cells[i] - shift)) & 1)
+                        table[bits] += power3(static_cast<int>(i));
+                }
+            }
+            this->tuples_.emplace_back(tuple);
+            this->weights_.resize(this->weights_.size() + power3(static_cast<int>(cells.size())), 0.f);
+        }
+
+        // 元の盤面と左右反転した盤面で、各タプルが指す重みの位置を書き込んで数を返す
+        int indices(uint64_t my_board, uint64_t all_board, uint32_t *out) const
+        {
+            int count = 0;
+            for (int side = 0; side < 2; side++)
+            {
+                const uint64_t my = side == 0 ? my_board : mirror(my_board);
+                const uint64_t opponent = side == 0 ? (all_board ^ my_board) : mirror(all_board ^ my_board);
+                for (const auto &tuple : this->tuples_)
+                    out[count++] = tuple.offset + index(my, opponent, tuple);
+            }
+            return count;
+        }
+
+        float sum(const uint32_t *index, int count) const
+        {
+            float total = 0;
+            int i = 0;
+#if defined(__AVX2__)
+            __m256 acc = _mm256_setzero_ps();
+            for (; i + 8 <= count; i += 8)
+            {
+                const __m256i vindex = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(index + i));
+                acc = _mm256_add_ps(acc, _mm256_i32gather_ps(this->weights_.data(), vindex, 4));
+            }
+            float lanes[8];
+            _mm256_storeu_ps(lanes, acc);
+            for (const float lane : lanes)
+                total += lane;
+#endif
+            for (; i < count; i++)
+                total += this->weights_[index[i]];
+            return total;
+        }
+
+        static void put16(std::string *out, uint16_t value)
+        {
+            out->push_back(static_cast<char>(value));
+            out->push_back(static_cast<char>(value >> 8));
+        }
+
+    public:
+        BasicNTupleNetwork()
+        {
+            for (uint32_t pattern = 0; pattern < (1u << MAX_LENGTH); pattern++)
+            {
+                uint32_t value = 0;
+                for (int i = MAX_LENGTH - 1; i >= 0; i--)
+                    value = value * 3 + ((pattern >> i) & 1);
+                this->ternary_[pattern] = value;
+            }
+        }
+
+        bool empty() const { return this->tuples_.empty(); }
+        size_t tupleCount() const { return this->tuples_.size(); }
+        size_t weightCount() const { return this->weights_.size(); }
+
+        // 盤上をランダムに歩いて隣り合うlength個のマスを選ぶことをcount回行い、重みを0にする
+        void init(int count, int length, uint32_t seed)
+        {
+            count = std::min(count, MAX_TUPLES);
+            length = std::max(1, std::min(length, std::min(MAX_LENGTH, H * W)));
+            this->tuples_.clear();
+            this->weights_.clear();
+            this->column_tables_.clear();
+            std::mt19937 random(seed);
+            for (int t = 0; t < count; t++)
+            {
+                int x = random() % W;
+                int y = random() % H;
+                std::vector<int> cells{x * (H + 1) + y};
+                while (static_cast<int>(cells.size()) < length)
+                {
+                    const int nx = x + static_cast<int>(random() % 3) - 1;
+                    const int ny = y + static_cast<int>(random() % 3) - 1;
+                    if (nx < 0 || nx >= W || ny < 0 || ny >= H)
+                        continue;
+                    x = nx;
+                    y = ny;
+                    const int cell = x * (H + 1) + y;
+                    if (std::find(cells.begin(), cells.end(), cell) == cells.end())
+                        cells.emplace_back(cell);
+                }
+                addTuple(cells);
+            }
+        }
+
+        // 手番のプレイヤーから見た値を-1〜1で返す
+        double value(uint64_t my_board, uint64_t all_board) const
+        {
+            uint32_t index[2 * MAX_TUPLES];
+            const int count = indices(my_board, all_board, index);
+            return std::tanh(sum(index, count));
+        }
+
+        double evaluate(typename BitState::Bits my_board, typename BitState::Bits all_board) const override
+        {
+            return (value(my_board, all_board) + 1.) * 0.5;
+        }
+
+        // 値をtarget(-1〜1)に近づける。rateは使われる重みの数で割ってから掛ける
+        void update(uint64_t my_board, uint64_t all_board, double target, double rate)
+        {
+            uint32_t index[2 * MAX_TUPLES];
+            const int count = indices(my_board, all_board, index);
+            if (count == 0)
+                return;
+            const double v = std::tanh(sum(index, count));
+            const float delta = static_cast<float>((target - v) * (1. - v * v) * rate / count);
+            for (int i = 0; i < count; i++)
+                this->weights_[index[i]] += delta;
+        }
+
+        std::string saveBuffer() const
+        {
+            float max_weight = 0;
+            for (const float w : this->weights_)
+                max_weight = std::max(max_weight, std::fabs(w));
+            const float scale = max_weight > 0 ? max_weight / 32767.f : 1.f;
+            uint32_t scale_bits;
+            std::memcpy(&scale_bits, &scale, sizeof(scale_bits));
+
+            std::string out(MAGIC, 4);
+            out.push_back(static_cast<char>(VERSION));
+            out.push_back(static_cast<char>(H));
+            out.push_back(static_cast<char>(W));
+            out.push_back(static_cast<char>(this->tuples_.size()));
+            put16(&out, static_cast<uint16_t>(scale_bits));
+            put16(&out, static_cast<uint16_t>(scale_bits >> 16));
+            out.append(4, '\0');
+            for (const auto &tuple : this->tuples_)
+            {
+                out.push_back(static_cast<char>(tuple.cells.size()));
+                for (const int cell : tuple.cells)
+                    out.push_back(static_cast<char>(cell));
+            }
+            for (const float w : this->weights_)
+                put16(&out, static_cast<uint16_t>(static_cast<int16_t>(std::lround(w / scale))));
+            return out;
+        }
+
+        bool save(std::ostream &os) const
+        {
+            const std::string buffer = saveBuffer();
+            os.write(buffer.data(), buffer.size());
+            return os.good();
+        }
+
+        bool save(const char *path) const
+        {
+            std::ofstream ofs(path, std::ios::binary);
+            return ofs && save(ofs);
+        }
+
+        // ファイルの中身を読み込む。形式が違えば何も変えずにfalseを返す
+        bool loadBuffer(const void *data, size_t size)
+        {
+            const uint8_t *p = static_cast<const uint8_t *>(data);
+            const uint8_t *end = p + size;
+            if (size < HEADER_BYTES || std::memcmp(p, MAGIC, 4) != 0 || p[4] != VERSION || p[5] != H || p[6] != W)
+                return false;
+            const int count = p[7];
+            const uint32_t scale_bits = uint32_t(p[8]) | uint32_t(p[9]) << 8 | uint32_t(p[10]) << 16 | uint32_t(p[11]) << 24;
+            float scale;
+            std::memcpy(&scale, &scale_bits, sizeof(scale));
+            p += HEADER_BYTES;
+
+            BasicNTupleNetwork network;
+            for (int t = 0; t < count; t++)
+            {
+                if (p >= end || *p == 0 || *p > MAX_LENGTH || end - p < 1 + *p)
+                    return false;
+                std::vector<int> cells(p + 1, p + 1 + *p);
+                for (const int cell : cells)
+                {
+                    if (cell % (H + 1) == H || cell >= W * (H + 1))
+                        return false;
+                }
+                p += 1 + *p;
+                network.addTuple(cells);
+            }
+            if (static_cast<size_t>(end - p) != network.weights_.size() * 2)
+                return false;
+            for (auto &w : network.weights_)
+            {
+                w = static_cast<int16_t>(uint16_t(p[0]) | uint16_t(p[1]) << 8) * scale;
+                p += 2;
+            }
+            this->tuples_ = std::move(network.tuples_);
+            this->weights_ = std::move(network.weights_);
+            this->column_tables_ = std::move(network.column_tables_);
+            return true;
+        }
+
+        bool load(std::istream &is)
+        {
+            const std::string buffer((std::istreambuf_iterator<char>(is)), std::istreambuf_iterator<char>());
+            return loadBuffer(buffer.data(), buffer.size());
+        }
+
+        bool load(const char *path)
+        {
+            std::ifstream ifs(path, std::ios::binary);
+            return ifs && load(ifs);
+        }
+    };
+
+    using NTupleNetwork = BasicNTupleNetwork<ConnectFourStateByBitSet>;
+}
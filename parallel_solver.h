@@ -0,0 +1,260 @@
+// 複数スレッドで局面を読み切るαβ法 (Lazy SMP)
+//
+// すべてのスレッドが同じ局面を読み、1つの置換表を共有する。ほかのスレッドが書いた結果で
+// 枝が早く切れることで速くなる。スレッドごとに浅い手の順番を変えて、別の枝から読むようにする。
+// どれか1つのスレッドが読み終えたら、その結果を使ってほかのスレッドを止める。
+//
+// 置換表のエントリは64ビット1つで、1回のアトミックな読み書きで扱うのでロックはいらない。
+//   bit 0-55 局面のキー、bit 56-57 値+1、bit 58-59 種類(1:正確 2:下限 3:上限 0:空き)、bit 60-63 最善の列
+#pragma once
+#include "02_BitBoard.h"
+#include <atomic>
+#include <memory>
+#include <thread>
+
+namespace montecarlo_bit
+{
+    template <class BitState>
+    class BasicTranspositionTable
+    {
+    private:
+        static_assert(BitState::Geometry::BITS <= 56, "key does not fit in an entry");
+        static_assert(BitState::W <= 16, "column does not fit in an entry");
+
+        static constexpr uint64_t KEY_MASK = (uint64_t(1) << 56) - 1;
+        static constexpr int VALUE_SHIFT = 56;
+        static constexpr int BOUND_SHIFT = 58;
+        static constexpr int ACTION_SHIFT = 60;
+
+        std::unique_ptr<std::atomic<uint64_t>[]> entries_;
+        size_t capacity_ = 0;
+
+        std::atomic<uint64_t> &slot(uint64_t key) const
+        {
+            uint64_t h = key * 0x9E3779B97F4A7C15ULL;
+            h ^= h >> 29;
+            return entries_[h % capacity_];
+        }
+
+    public:
+        enum Bound
+        {
+            NONE = 0,
+            EXACT = 1,
+            LOWER = 2,
+            UPPER = 3,
+        };
+
+        struct Entry
+        {
+            int value;  // 手番のプレイヤーから見た勝敗(1, 0, -1)
+            Bound bound;
+            int action; // 最善の列
+        };
+
+        explicit BasicTranspositionTable(size_t bytes)
+            : entries_(new std::atomic<uint64_t>[std::max<size_t>(1, bytes / sizeof(uint64_t))]),
+              capacity_(std::max<size_t>(1, bytes / sizeof(uint64_t)))
+        {
+            clear();
+        }
+
+        size_t capacity() const { return capacity_; }
+        size_t bytes() const { return capacity_ * sizeof(uint64_t); }
+
+        void clear()
+        {
+            for (size_t i = 0; i < capacity_; i++)
+                entries_[i].store(0, std::memory_order_relaxed);
+        }
+
+        bool probe(uint64_t key, Entry *entry) const
+        {
+            const uint64_t packed = slot(key).load(std::memory_order_relaxed);
+            const auto bound = static_cast<Bound>((packed >> BOUND_SHIFT) & 3);
+            if (bound == NONE || (packed & KEY_MASK) != key)
+                return false;
+            entry->value = static_cast<int>((packed >> VALUE_SHIFT) & 3) - 1;
+            entry->bound = bound;
+            entry->action = static_cast<int>(packed >> ACTION_SHIFT);
+            return true;
+        }
+
+        // 同じ場所のエントリは常に上書きする
+        void store(uint64_t key, int value, Bound bound, int action)
+        {
+            const uint64_t packed = key | (uint64_t(value + 1) << VALUE_SHIFT) | (uint64_t(bound) << BOUND_SHIFT) |
+                                    (uint64_t(action) << ACTION_SHIFT);
+            slot(key).store(packed, std::memory_order_relaxed);
+        }
+    };
+
+    template <class BitState>
+    class BasicParallelSolver
+    {
+    private:
+        using Bits = typename BitState::Bits;
+        using Geometry = typename BitState::Geometry;
+        using Table = BasicTranspositionTable<BitState>;
+
+        static constexpr int SHUFFLE_PLIES = 3; // 手の順番をスレッドごとに変える深さ
+
+        Table table_;
+        std::atomic<bool> stop_{false};
+
+        // 1つのスレッドの探索
+        struct Worker
+        {
+            BasicParallelSolver *solver;
+            int id;
+            uint64_t nodes = 0;
+            int root_action = -1;
+
+            // 手番のプレイヤーから見た勝敗を返す。止められたら0を返し、表には書かない
+            int search(const BitState &state, int alpha, int beta, int ply)
+            {
+                if (solver->stop_.load(std::memory_order_relaxed))
+                    return 0;
+                ++nodes;
+                const Bits winning = state.winningMoves();
+                if (winning != 0)
+                {
+                    if (ply == 0)
+                        root_action = BitState::cellColumn(winning);
+                    return 1;
+                }
+                const Bits moves = state.nonLosingMoves();
+                if (moves == 0)
+                {
+                    if (ply == 0)
+                        root_action = BitState::cellColumn(state.possibleMoves());
+                    return -1;
+                }
+
+                const uint64_t key = static_cast<uint64_t>(state.key());
+                typename Table::Entry entry;
+                int hint = -1;
+                if (solver->table_.probe(key, &entry))
+                {
+                    hint = entry.action;
+                    if (ply > 0)
+                    {
+                        if (entry.bound == Table::EXACT)
+                            return entry.value;
+                        if (entry.bound == Table::LOWER)
+                            alpha = std::max(alpha, entry.value);
+                        else
+                            beta = std::min(beta, entry.value);
+                        if (alpha >= beta)
+                            return entry.value;
+                    }
+                }
+
+                int order[BitState::W];
+                const int count = orderMoves(state, moves, hint, ply, order);
+                const int original_alpha = alpha;
+                int best = -2;
+                int best_action = order[0];
+                for (int i = 0; i < count; i++)
+                {
+                    BitState next = state;
+                    next.advance(order[i]);
+                    // 勝てる手はないので、終局するのは盤面が埋まった引き分けだけ
+                    const int score = next.isDone() ? 0 : -search(next, -beta, -alpha, ply + 1);
+                    if (solver->stop_.load(std::memory_order_relaxed))
+                        return 0;
+                    if (score > best)
+                    {
+                        best = score;
+                        best_action = order[i];
+                    }
+                    alpha = std::max(alpha, score);
+                    if (alpha >= beta)
+                        break;
+                }
+                const auto bound = best <= original_alpha ? Table::UPPER : (best >= beta ? Table::LOWER : Table::EXACT);
+                solver->table_.store(key, best, bound, best_action);
+                if (ply == 0)
+                    root_action = best_action;
+                return best;
+            }
+
+            // 表の手、置いた後に自分の勝ちマスが多い手、中央に近い手の順に並べる
+            int orderMoves(const BitState &state, Bits moves, int hint, int ply, int *order) const
+            {
+                int scores[BitState::W];
+                int count = 0;
+                for (int i = 0; i < BitState::W; i++)
+                {
+                    const int x = solverColumn<BitState>(i);
+                    const Bits cell = moves & Geometry::columnBits(x);
+                    if (cell == 0)
+                        continue;
+                    const Bits threats = BitState::winningCells(state.getMyBoard() | cell, state.getAllBoard() | cell);
+                    int score = x == hint ? 1000 : bitCount(threats);
+                    // 挿入ソート。同点なら中央に近い手が先
+                    int j = count++;
+                    for (; j > 0 && scores[j - 1] < score; j--)
+                    {
+                        scores[j] = scores[j - 1];
+                        order[j] = order[j - 1];
+                    }
+                    scores[j] = score;
+                    order[j] = x;
+                }
+                // 補助のスレッドは浅い手を回して、主のスレッドと違う枝から読む
+                if (id > 0 && ply < SHUFFLE_PLIES && count > 1)
+                    std::rotate(order, order + (id + ply) % count, order + count);
+                return count;
+            }
+        };
+
+    public:
+        explicit BasicParallelSolver(size_t table_bytes) : table_(table_bytes) {}
+
+        Table &table() { return table_; }
+
+        // 終局していない局面を読み切り、手番のプレイヤーから見た勝敗(1, 0, -1)を返す。
+        // 表は前回の結果を残したまま使う
+        int solve(const BitState &state, int threads, int *action = nullptr, uint64_t *nodes = nullptr)
+        {
+            threads = std::max(1, threads);
+            stop_ = false;
+            std::vector<Worker> workers;
+            for (int i = 0; i < threads; i++)
+                workers.emplace_back(Worker{this, i});
+            std::atomic<int> finished{-1};
+            std::vector<int> scores(threads, 0);
+            std::vector<std::thread> helpers;
+            auto run = [&](int i)
+            {
+                const int score = workers[i].search(state, -1, 1, 0);
+                int expected = -1;
+                if (finished.compare_exchange_strong(expected, i))
+                {
+                    scores[i] = score;
+                    stop_ = true;
+                }
+            };
+            for (int i = 1; i < threads; i++)
+                helpers.emplace_back(run, i);
+            run(0);
+            for (auto &t : helpers)
+                t.join();
+
+            const int winner = finished;
+            if (action != nullptr)
+                *action = workers[winner].root_action;
+            if (nodes != nullptr)
+            {
+                *nodes = 0;
+                for (const auto &worker : workers)
+                    *nodes += worker.nodes;
+            }
+            return scores[winner];
+        }
+    };
+
+    using TranspositionTable = BasicTranspositionTable<ConnectFourStateByBitSet>;
+    using ParallelSolver = BasicParallelSolver<ConnectFourStateByBitSet>;
+}
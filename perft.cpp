@@ -0,0 +1,308 @@
+// Counts the move sequences of each length from a position (perft) to check
+// and time the move generator.
+//
+// perft(d) is the number of ways to play d moves; a game that ends earlier
+// is not extended. The bitboard state is used by default. -r runs the same
+// count on the reference ConnectFourState for comparison. -x walks both
+// states side by side and checks that they agree on every position: legal
+// moves, results, winning moves and key()/fromKey().
+#include "02_BitBoard.h"
+#include "position.h"
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <string.h>
+
+using namespace montecarlo_bit;
+using namespace std;
+
+struct Options {
+    int depth = 8;
+    int threads = 1;
+    size_t hash_mb = 0;  // 0 for no transposition table
+    bool reference = false;
+    bool cross_check = false;
+    bool divide = false;
+};
+
+// Counts already seen for (position, remaining depth). key() is unique, so
+// a hit is always exact; a collision just replaces the older entry.
+class PerftTable {
+private:
+    struct Entry {
+        uint64_t key;
+        uint64_t count;
+        int depth;
+    };
+    vector<Entry> entries_;
+
+    Entry& slot(uint64_t key, int depth) {
+        uint64_t h = (key ^ uint64_t(depth) << 58) * 0x9E3779B97F4A7C15ULL;
+        return entries_[(h >> 20) % entries_.size()];
+    }
+
+public:
+    explicit PerftTable(size_t bytes) : entries_(max<size_t>(1, bytes / sizeof(Entry)), Entry{0, 0, -1}) {}
+
+    bool lookup(uint64_t key, int depth, uint64_t* count) {
+        const Entry& entry = slot(key, depth);
+        if (entry.depth != depth || entry.key != key)
+            return false;
+        *count = entry.count;
+        return true;
+    }
+
+    void store(uint64_t key, int depth, uint64_t count) { slot(key, depth) = Entry{key, count, depth}; }
+};
+
+static uint64_t perft(const ConnectFourStateByBitSet& state, int depth, PerftTable* table) {
+    if (depth == 0)
+        return 1;
+    if (state.isDone())
+        return 0;
+    uint64_t count = 0;
+    const uint64_t key = state.key();
+    if (table != nullptr && depth >= 2 && table->lookup(key, depth, &count))
+        return count;
+    auto possible = state.possibleMoves();
+    while (possible != 0) {
+        const auto cell = possible & -possible;
+        possible ^= cell;
+        ConnectFourStateByBitSet next = state;
+        next.advance(ConnectFourStateByBitSet::cellColumn(cell));
+        count += depth == 1 ? 1 : perft(next, depth - 1, table);
+    }
+    if (table != nullptr && depth >= 2)
+        table->store(key, depth, count);
+    return count;
+}
+
+static uint64_t perftReference(const ConnectFourState& state, int depth) {
+    if (depth == 0)
+        return 1;
+    if (state.isDone())
+        return 0;
+    uint64_t count = 0;
+    for (const int action : state.legalActions()) {
+        ConnectFourState next = state;
+        next.advance(action);
+        count += perftReference(next, depth - 1);
+    }
+    return count;
+}
+
+static ConnectFourState toReference(const ConnectFourStateByBitSet& state) {
+    ConnectFourState result;
+    result.is_first_ = state.isFirst();
+    const int me = state.isFirst() ? 1 : 2;
+    for (int y = 0; y < H; y++) {
+        for (int x = 0; x < W; x++) {
+            const int cell = state.getCell(x, y);
+            result.my_board_[y][x] = cell == me;
+            result.enemy_board_[y][x] = cell != 0 && cell != me;
+        }
+    }
+    return result;
+}
+
+// Walks both states to the given depth and reports the first few positions
+// where they disagree.
+class CrossChecker {
+private:
+    string moves_;
+    int mismatches_ = 0;
+
+    void report(const char* what) {
+        if (++mismatches_ <= 10)
+            cerr << "mismatch (" << what << ") after moves \"" << moves_ << "\"" << endl;
+    }
+
+public:
+    int mismatches() const { return mismatches_; }
+
+    uint64_t run(const ConnectFourStateByBitSet& state, const ConnectFourState& reference, int depth) {
+        if (state.getWinningStatus() != reference.getWinningStatus()) {
+            report("result");
+            return 0;
+        }
+        if (!state.isDone() && !(ConnectFourStateByBitSet::fromKey(state.key()) == state))
+            report("fromKey");
+        if (depth == 0)
+            return 1;
+        if (state.isDone())
+            return 0;
+
+        const auto legal = reference.legalActions();
+        if (state.legalActions() != legal)
+            report("legalActions");
+        uint32_t legal_columns = 0;
+        for (const int action : legal)
+            legal_columns |= 1u << action;
+        if (ConnectFourStateByBitSet::columnsOf(state.possibleMoves()) != legal_columns)
+            report("possibleMoves");
+
+        const uint32_t winning_columns = ConnectFourStateByBitSet::columnsOf(state.winningMoves());
+        uint64_t count = 0;
+        for (const int action : legal) {
+            ConnectFourStateByBitSet next = state;
+            ConnectFourState next_reference = reference;
+            next.advance(action);
+            next_reference.advance(action);
+            const bool wins = next_reference.getWinningStatus() == WinningStatus::LOSE;
+            if (wins != ((winning_columns >> action) & 1))
+                report("winningMoves");
+            moves_.push_back(static_cast<char>('1' + action));
+            count += run(next, next_reference, depth - 1);
+            moves_.pop_back();
+        }
+        return count;
+    }
+};
+
+// Collects the positions after `ply` moves so that threads can share them out.
+static void collect(const ConnectFourStateByBitSet& state, int ply, vector<ConnectFourStateByBitSet>* positions) {
+    if (ply == 0) {
+        positions->emplace_back(state);
+        return;
+    }
+    if (state.isDone())
+        return;
+    for (const int action : state.legalActions()) {
+        ConnectFourStateByBitSet next = state;
+        next.advance(action);
+        collect(next, ply - 1, positions);
+    }
+}
+
+// Shares the positions a few moves ahead out between threads. Each thread
+// has its own table, so no locking is needed.
+class ParallelPerft {
+private:
+    int threads_;
+    vector<unique_ptr<PerftTable>> tables_;
+
+public:
+    ParallelPerft(int threads, size_t hash_bytes) : threads_(max(1, threads)) {
+        for (int i = 0; i < threads_ && hash_bytes > 0; ++i)
+            tables_.emplace_back(new PerftTable(hash_bytes / threads_));
+    }
+
+    PerftTable* table(int i) const { return tables_.empty() ? nullptr : tables_[i].get(); }
+
+    uint64_t count(const ConnectFourStateByBitSet& root, int depth) {
+        if (threads_ == 1 || depth < 4)
+            return perft(root, depth, table(0));
+        // Split deep enough that every thread gets several positions.
+        int split = 0;
+        vector<ConnectFourStateByBitSet> positions{root};
+        while (split < depth - 2 && positions.size() < static_cast<size_t>(threads_) * 16) {
+            ++split;
+            positions.clear();
+            collect(root, split, &positions);
+        }
+
+        atomic<size_t> next{0};
+        atomic<uint64_t> total{0};
+        vector<thread> threads;
+        for (int i = 0; i < threads_; ++i) {
+            threads.emplace_back([&, i]() {
+                uint64_t count = 0;
+                for (size_t j; (j = next++) < positions.size();)
+                    count += perft(positions[j], depth - split, table(i));
+                total += count;
+            });
+        }
+        for (auto& t : threads)
+            t.join();
+        return total;
+    }
+};
+
+static void usage() {
+    cerr << "Usage: perft [options] [position]\n"
+         << "  -d N      count up to N moves (default 8)\n"
+         << "  -j N      threads (default 1)\n"
+         << "  -H MB     transposition table size, shared out between threads (default: none)\n"
+         << "  -r        count with the reference ConnectFourState\n"
+         << "  -x        check the bitboard state against ConnectFourState at every position\n"
+         << "  --divide  print the count below each first move at the last depth\n"
+         << "position is a move sequence (\"4453\") or board rows separated by '/'; default is the empty board.\n";
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    const char* position = "";
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (strcmp(arg, "-d") == 0 && has_value) {
+            options.depth = atoi(argv[++i]);
+        } else if (strcmp(arg, "-j") == 0 && has_value) {
+            options.threads = atoi(argv[++i]);
+        } else if (strcmp(arg, "-H") == 0 && has_value) {
+            options.hash_mb = atoll(argv[++i]);
+        } else if (strcmp(arg, "-r") == 0) {
+            options.reference = true;
+        } else if (strcmp(arg, "-x") == 0) {
+            options.cross_check = true;
+        } else if (strcmp(arg, "--divide") == 0) {
+            options.divide = true;
+        } else if (arg[0] != '-') {
+            position = arg;
+        } else {
+            usage();
+            return 1;
+        }
+    }
+    ConnectFourStateByBitSet root;
+    if (options.depth < 1 || !parsePosition(position, &root)) {
+        usage();
+        return 1;
+    }
+    if ((options.reference || options.cross_check) && root.isDone()) {
+        cerr << "The game is already over" << endl;
+        return 1;
+    }
+    // The reference state and the cross-check only run single-threaded without a table.
+    if (options.reference || options.cross_check) {
+        options.threads = 1;
+        options.hash_mb = 0;
+    }
+    const ConnectFourState reference = toReference(root);
+    ParallelPerft parallel(options.threads, options.hash_mb << 20);
+
+    const char* name = options.cross_check ? "cross-check" : (options.reference ? "reference" : "bitboard");
+    printf("%s, %d thread(s), %zu MB hash\n", name, options.threads, options.hash_mb);
+    printf("%5s %16s %10s %14s\n", "depth", "nodes", "seconds", "nodes/s");
+    int mismatches = 0;
+    for (int depth = 1; depth <= options.depth; ++depth) {
+        auto start = chrono::steady_clock::now();
+        uint64_t nodes;
+        if (options.cross_check) {
+            CrossChecker checker;
+            nodes = checker.run(root, reference, depth);
+            mismatches += checker.mismatches();
+        } else if (options.reference) {
+            nodes = perftReference(reference, depth);
+        } else {
+            nodes = parallel.count(root, depth);
+        }
+        double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        printf("%5d %16llu %10.3f %14.0f\n", depth, (unsigned long long)nodes, elapsed, elapsed > 0 ? nodes / elapsed : 0.0);
+        fflush(stdout);
+    }
+
+    if (options.divide && !root.isDone()) {
+        for (const int action : root.legalActions()) {
+            ConnectFourStateByBitSet next = root;
+            next.advance(action);
+            uint64_t nodes = options.reference ? perftReference(toReference(next), options.depth - 1)
+                                               : parallel.count(next, options.depth - 1);
+            printf("%d: %llu\n", action + 1, (unsigned long long)nodes);
+        }
+    }
+    if (options.cross_check)
+        printf("%d mismatches\n", mismatches);
+    return mismatches == 0 ? 0 : 1;
+}
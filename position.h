@@ -0,0 +1,118 @@
+// 局面の文字列表現の読み書き
+//
+// 手順: 打った列を1始まりの数字で並べたもの (例: "4453")
+// 盤面: 上の段から'/'区切りで並べたもの。'x'が先手、'o'が後手、'.'が空き
+//       (例: "......./......./......./......./...o.../...x...")
+#pragma once
+#include "02_BitBoard.h"
+#include <string>
+
+// 手順を初期局面から適用する。列が埋まっている、または終局後の手があればfalseを返す
+template <class BitState>
+bool parseMoves(const std::string &moves, BitState *state)
+{
+    BitState result;
+    for (const char c : moves)
+    {
+        int action = c - '1';
+        if (action < 0 || action >= BitState::W || result.isDone())
+            return false;
+        if ((result.getAllBoard() & BitState::Geometry::columnBits(action)) == BitState::Geometry::columnBits(action))
+            return false;
+        result.advance(action);
+    }
+    *state = result;
+    return true;
+}
+
+// 盤面を読み込む。手番は石の数から決める。宙に浮いた石や石の数が合わない盤面はfalseを返す
+template <class BitState>
+bool parseRows(const std::string &rows, BitState *state)
+{
+    using Bits = typename BitState::Bits;
+    constexpr int H = BitState::H;
+    constexpr int W = BitState::W;
+    Bits first_board = 0;
+    Bits all_board = 0;
+    int y = H - 1;
+    int x = 0;
+    int first_count = 0;
+    int second_count = 0;
+    for (const char c : rows)
+    {
+        if (c == '/')
+        {
+            if (x != W)
+                return false;
+            --y;
+            x = 0;
+            continue;
+        }
+        if (y < 0 || x >= W)
+            return false;
+        Bits bit = Bits(1) << (x * (H + 1) + y);
+        switch (c)
+        {
+        case 'x':
+            first_board |= bit;
+            all_board |= bit;
+            ++first_count;
+            break;
+        case 'o':
+            all_board |= bit;
+            ++second_count;
+            break;
+        case '.':
+            break;
+        default:
+            return false;
+        }
+        ++x;
+    }
+    if (y != 0 || x != W)
+        return false;
+    // 下から詰めて置かれていれば、各列の石に最下段を足すと1ビットだけになる
+    for (int col = 0; col < W; col++)
+    {
+        Bits column = (all_board >> (col * (H + 1))) & BitState::Geometry::COLUMN_BITS;
+        if ((column & (column + 1)) != 0)
+            return false;
+    }
+    bool is_first;
+    if (first_count == second_count)
+        is_first = true;
+    else if (first_count == second_count + 1)
+        is_first = false;
+    else
+        return false;
+    Bits my_board = is_first ? first_board : (all_board ^ first_board);
+    *state = BitState::fromBoards(my_board, all_board, is_first);
+    return true;
+}
+
+// 手順か盤面のどちらかの形式で読み込む
+template <class BitState>
+bool parsePosition(const std::string &text, BitState *state)
+{
+    if (text.find('/') != std::string::npos)
+        return parseRows(text, state);
+    return parseMoves(text, state);
+}
+
+// 盤面の形式で書き出す
+template <class BitState>
+std::string formatRows(const BitState &state)
+{
+    std::string rows;
+    for (int y = BitState::H - 1; y >= 0; y--)
+    {
+        for (int x = 0; x < BitState::W; x++)
+        {
+            static const char cells[] = {'.', 'x', 'o'};
+            rows += cells[state.getCell(x, y)];
+        }
+        if (y > 0)
+            rows += '/';
+    }
+    return rows;
+}
@@ -0,0 +1,153 @@
+// Solves positions exactly with the multi-threaded alpha-beta solver.
+//
+// Prints the result for the side to move (win/draw/loss), a best move, the
+// node count and the time. --bench solves a fixed suite of positions with
+// 1, 2, 4, ... threads up to -j and prints the speedup over one thread.
+// --dfpn uses proof-number search instead and prints the line both sides
+// play in the proof; -H is then the whole memory it may use.
+#include "dfpn.h"
+#include "parallel_solver.h"
+#include "position.h"
+#include <iostream>
+#include <string.h>
+
+using namespace montecarlo_bit;
+using namespace std;
+
+// Early and middle game positions with wins, draws and losses for the side
+// to move. One thread solves each in about a second or less.
+static const char* const BENCH_POSITIONS[] = {
+    "64451735", "33566352", "53251677", "4124651241", "2161774536", "7572677177", "1663516151",
+};
+
+static const char* resultName(int score) {
+    return score > 0 ? "win" : (score < 0 ? "loss" : "draw");
+}
+
+static void usage() {
+    cerr << "Usage: solve [options] position...\n"
+         << "  -j N      threads (default: number of cores)\n"
+         << "  -H MB     transposition table size (default 256)\n"
+         << "  --bench   solve a fixed suite with 1, 2, 4, ... threads and print the speedup\n"
+         << "  --dfpn    use single-threaded proof-number search and print the proof line\n"
+         << "  -n N      with --dfpn, give up after N nodes (default: no limit)\n"
+         << "position is a move sequence (\"4453\") or board rows separated by '/'.\n";
+}
+
+static string formatLine(const vector<int>& line) {
+    string s;
+    for (const int action : line)
+        s += static_cast<char>('1' + action);
+    return s;
+}
+
+static int solveDfpn(const vector<const char*>& positions, size_t table_bytes, uint64_t max_nodes) {
+    DfpnSolver solver(table_bytes);
+    for (const char* text : positions) {
+        ConnectFourStateByBitSet state;
+        if (!parsePosition(text, &state) || state.isDone()) {
+            cerr << "Invalid or finished position: " << text << endl;
+            return 1;
+        }
+        vector<int> line;
+        const uint64_t start_nodes = solver.nodes();
+        auto start = chrono::steady_clock::now();
+        const WinningStatus result = solver.solve(state, max_nodes, &line);
+        double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        static const char* names[] = {"win", "loss", "draw", "unknown"};
+        printf("%s: %s, line %s, %llu nodes, %.3f s, table %llu stored, %llu replaced\n", text, names[result], formatLine(line).c_str(),
+               (unsigned long long)(solver.nodes() - start_nodes), elapsed, (unsigned long long)solver.stored(), (unsigned long long)solver.replaced());
+        fflush(stdout);
+    }
+    return 0;
+}
+
+static void bench(ParallelSolver* solver, int max_threads) {
+    vector<ConnectFourStateByBitSet> suite;
+    for (const char* text : BENCH_POSITIONS) {
+        ConnectFourStateByBitSet state;
+        parsePosition(text, &state);
+        suite.emplace_back(state);
+    }
+    vector<int> expected;
+    double base = 0;
+    printf("%7s %10s %14s %14s %8s\n", "threads", "seconds", "nodes", "nodes/s", "speedup");
+    for (int threads = 1;; threads = min(threads * 2, max_threads)) {
+        uint64_t total_nodes = 0;
+        double total = 0;
+        for (size_t i = 0; i < suite.size(); ++i) {
+            solver->table().clear();
+            uint64_t nodes = 0;
+            auto start = chrono::steady_clock::now();
+            const int score = solver->solve(suite[i], threads, nullptr, &nodes);
+            total += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            total_nodes += nodes;
+            if (expected.size() <= i)
+                expected.emplace_back(score);
+            else if (expected[i] != score)
+                cerr << "result changed with " << threads << " threads: " << BENCH_POSITIONS[i] << endl;
+        }
+        if (threads == 1)
+            base = total;
+        printf("%7d %10.3f %14llu %14.0f %8.2f\n", threads, total, (unsigned long long)total_nodes, total_nodes / total, base / total);
+        fflush(stdout);
+        if (threads >= max_threads)
+            break;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    int threads = max(1u, thread::hardware_concurrency());
+    size_t table_mb = 256;
+    bool run_bench = false;
+    bool dfpn = false;
+    uint64_t max_nodes = UINT64_MAX;
+    vector<const char*> positions;
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (strcmp(arg, "-j") == 0 && has_value) {
+            threads = atoi(argv[++i]);
+        } else if (strcmp(arg, "-H") == 0 && has_value) {
+            table_mb = atoll(argv[++i]);
+        } else if (strcmp(arg, "--bench") == 0) {
+            run_bench = true;
+        } else if (strcmp(arg, "--dfpn") == 0) {
+            dfpn = true;
+        } else if (strcmp(arg, "-n") == 0 && has_value) {
+            max_nodes = strtoull(argv[++i], nullptr, 10);
+        } else if (arg[0] != '-') {
+            positions.emplace_back(arg);
+        } else {
+            usage();
+            return 1;
+        }
+    }
+    if (threads < 1 || (!run_bench && positions.empty())) {
+        usage();
+        return 1;
+    }
+
+    if (dfpn && !run_bench)
+        return solveDfpn(positions, table_mb << 20, max_nodes);
+    ParallelSolver solver(table_mb << 20);
+    if (run_bench) {
+        bench(&solver, threads);
+        return 0;
+    }
+    for (const char* text : positions) {
+        ConnectFourStateByBitSet state;
+        if (!parsePosition(text, &state) || state.isDone()) {
+            cerr << "Invalid or finished position: " << text << endl;
+            return 1;
+        }
+        int action = -1;
+        uint64_t nodes = 0;
+        auto start = chrono::steady_clock::now();
+        const int score = solver.solve(state, threads, &action, &nodes);
+        double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        printf("%s: %s, best %d, %llu nodes, %.3f s\n", text, resultName(score), action + 1, (unsigned long long)nodes, elapsed);
+        fflush(stdout);
+    }
+    return 0;
+}
@@ -0,0 +1,197 @@
+// 読み切った局面の結果をファイルに保存し、プロセスをまたいで共有する表 (POSIX)
+//
+// ファイルは固定長で、16バイトのヘッダの後に8バイトのエントリが並ぶ。
+//   ヘッダ: "C4SC" バージョン(1) H(1) W(1) 予約(1) エントリ数(8)
+//   エントリ: bit 0-55 局面のキー、bit 56-59 最善の列、bit 60-61 手番から見た結果、bit 63 有効
+// ファイルをmmapして、エントリを1回の64ビットのアトミックな書き込みで更新するので、
+// 書き込み中にプロセスが落ちても中途半端なエントリは残らない。
+// 複数のスレッド・プロセスから同時に読み書きしてよい。
+#pragma once
+#include "02_BitBoard.h"
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace montecarlo_bit
+{
+    template <class BitState>
+    class BasicSolvedCache : public SolvedTable
+    {
+    private:
+        static_assert(BitState::Geometry::BITS <= 56, "key does not fit in an entry");
+        static_assert(BitState::W <= 16, "column does not fit in an entry");
+
+        static constexpr char MAGIC[4] = {'C', '4', 'S', 'C'};
+        static constexpr uint8_t VERSION = 1;
+        static constexpr size_t HEADER_BYTES = 16;
+        static constexpr int PROBES = 8; // 1つのキーを探すエントリ数
+
+        static constexpr uint64_t KEY_MASK = (uint64_t(1) << 56) - 1;
+        static constexpr int ACTION_SHIFT = 56;
+        static constexpr int RESULT_SHIFT = 60;
+        static constexpr uint64_t VALID = uint64_t(1) << 63;
+
+        uint8_t *data_ = nullptr;
+        size_t size_ = 0;
+        uint64_t *entries_ = nullptr;
+        uint64_t capacity_ = 0;
+        std::atomic<uint64_t> hits_{0};
+        std::atomic<uint64_t> misses_{0};
+
+        static uint64_t pack(uint64_t key, WinningStatus result, int action)
+        {
+            return VALID | (uint64_t(result) << RESULT_SHIFT) | (uint64_t(action) << ACTION_SHIFT) | key;
+        }
+
+        size_t slot(uint64_t key, int probe) const
+        {
+            uint64_t h = key * 0x9E3779B97F4A7C15ULL;
+            h ^= h >> 29;
+            return (h + probe) % capacity_;
+        }
+
+        static void writeHeader(uint8_t *header, uint64_t capacity)
+        {
+            std::memset(header, 0, HEADER_BYTES);
+            std::memcpy(header, MAGIC, 4);
+            header[4] = VERSION;
+            header[5] = BitState::H;
+            header[6] = BitState::W;
+            for (int i = 0; i < 8; i++)
+                header[8 + i] = static_cast<uint8_t>(capacity >> (8 * i));
+        }
+
+        // 一時ファイルにヘッダを書いてからlinkするので、作りかけのファイルが見えることはない
+        static bool create(const std::string &path, uint64_t capacity)
+        {
+            std::string tmp = path + ".tmp." + std::to_string(getpid());
+            int fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0)
+                return false;
+            uint8_t header[HEADER_BYTES];
+            writeHeader(header, capacity);
+            bool ok = ftruncate(fd, HEADER_BYTES + capacity * sizeof(uint64_t)) == 0 &&
+                      pwrite(fd, header, HEADER_BYTES, 0) == static_cast<ssize_t>(HEADER_BYTES) &&
+                      fsync(fd) == 0;
+            ::close(fd);
+            // 同時に作られていた場合は先に作られた方を使う
+            ok = ok && (link(tmp.c_str(), path.c_str()) == 0 || errno == EEXIST);
+            unlink(tmp.c_str());
+            return ok;
+        }
+
+    public:
+        BasicSolvedCache() {}
+        BasicSolvedCache(const BasicSolvedCache &) = delete;
+        BasicSolvedCache &operator=(const BasicSolvedCache &) = delete;
+        ~BasicSolvedCache() { close(); }
+
+        // メモリ量(バイト)からエントリ数を求める
+        static uint64_t entriesForBytes(size_t bytes) { return bytes / sizeof(uint64_t); }
+
+        // ファイルを開く。なければcapacity個のエントリで作る。既存のファイルはその大きさのまま使う
+        bool open(const std::string &path, uint64_t capacity)
+        {
+            close();
+            int fd = ::open(path.c_str(), O_RDWR);
+            if (fd < 0 && errno == ENOENT && capacity > 0 && create(path, capacity))
+                fd = ::open(path.c_str(), O_RDWR);
+            if (fd < 0)
+                return false;
+            struct stat st;
+            if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(HEADER_BYTES))
+            {
+                ::close(fd);
+                return false;
+            }
+            void *p = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            ::close(fd);
+            if (p == MAP_FAILED)
+                return false;
+            data_ = static_cast<uint8_t *>(p);
+            size_ = st.st_size;
+
+            uint64_t file_capacity = 0;
+            for (int i = 0; i < 8; i++)
+                file_capacity |= uint64_t(data_[8 + i]) << (8 * i);
+            if (std::memcmp(data_, MAGIC, 4) != 0 || data_[4] != VERSION || data_[5] != BitState::H || data_[6] != BitState::W ||
+                file_capacity == 0 || size_ != HEADER_BYTES + file_capacity * sizeof(uint64_t))
+            {
+                close();
+                return false;
+            }
+            entries_ = reinterpret_cast<uint64_t *>(data_ + HEADER_BYTES);
+            capacity_ = file_capacity;
+            return true;
+        }
+
+        void close()
+        {
+            if (data_ != nullptr)
+                munmap(data_, size_);
+            data_ = nullptr;
+            size_ = 0;
+            entries_ = nullptr;
+            capacity_ = 0;
+        }
+
+        bool isOpen() const { return data_ != nullptr; }
+        uint64_t capacity() const { return capacity_; }
+        uint64_t hits() const { return hits_; }
+        uint64_t misses() const { return misses_; }
+
+        // 書き込まれたエントリ数を数える
+        uint64_t count() const
+        {
+            uint64_t n = 0;
+            for (uint64_t i = 0; i < capacity_; i++)
+                n += (__atomic_load_n(&entries_[i], __ATOMIC_RELAXED) & VALID) != 0;
+            return n;
+        }
+
+        // 変更をディスクに書き出すよう要求する。書き出しを待たない
+        void flush() { msync(data_, size_, MS_ASYNC); }
+
+        bool lookup(uint64_t key, WinningStatus *result, int *action) override
+        {
+            for (int i = 0; i < PROBES; i++)
+            {
+                const uint64_t entry = __atomic_load_n(&entries_[slot(key, i)], __ATOMIC_ACQUIRE);
+                if ((entry & VALID) == 0)
+                    break;
+                if ((entry & KEY_MASK) == key)
+                {
+                    *result = static_cast<WinningStatus>((entry >> RESULT_SHIFT) & 3);
+                    *action = static_cast<int>((entry >> ACTION_SHIFT) & 15);
+                    ++hits_;
+                    return true;
+                }
+            }
+            ++misses_;
+            return false;
+        }
+
+        // 空いているエントリに書き込む。探す範囲が埋まっていれば1つを上書きする
+        void store(uint64_t key, WinningStatus result, int action) override
+        {
+            const uint64_t value = pack(key, result, action);
+            for (int i = 0; i < PROBES; i++)
+            {
+                uint64_t *entry = &entries_[slot(key, i)];
+                uint64_t expected = 0;
+                if (__atomic_compare_exchange_n(entry, &expected, value, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+                    return;
+                if ((expected & KEY_MASK) == key)
+                    return;
+            }
+            __atomic_store_n(&entries_[slot(key, static_cast<int>((key >> 8) % PROBES))], value, __ATOMIC_RELEASE);
+        }
+    };
+
+    using SolvedCache = BasicSolvedCache<ConnectFourStateByBitSet>;
+}
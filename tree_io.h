@@ -0,0 +1,420 @@
+// 探索木のバイナリ形式での保存と読み込み
+//
+// 形式(数値はすべてリトルエンディアン):
+//   "C4TR" バージョン(2) H(1) W(1) 根の手番(1)
+//   根の自分の盤面・全体の盤面 (各 (W*(H+1)+7)/8 バイト)
+//   以降、行きがけ順に各ノードについて
+//     n       : varint
+//     w       : zigzag varint (W_SCALE倍した固定小数点)
+//     子の列  : varint (作られた子ノードの列のビット。0なら葉)
+//   子ノードの盤面は親の盤面に列の手を打って求める。
+#pragma once
+#include "02_BitBoard.h"
+#include <cstring>
+#include <fstream>
+#include <ostream>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace montecarlo_bit
+{
+    namespace tree_io
+    {
+        constexpr const char MAGIC[4] = {'C', '4', 'T', 'R'};
+        constexpr const uint8_t VERSION = 2;
+        constexpr const uint8_t MIN_VERSION = 1; // 1は展開したノードが必ずすべての子ノードを持つ
+        constexpr const double W_SCALE = 1024.; // wの固定小数点の倍率
+        constexpr const int MAX_DEPTH = 128;     // 読み込み時に許す最大の深さ
+
+        constexpr int boardBytes(int bits) { return (bits + 7) / 8; }
+
+        // バッファリングしながらストリームに書き出す
+        class Writer
+        {
+        private:
+            std::ostream &os_;
+            char buf_[4096];
+            size_t len_ = 0;
+
+        public:
+            explicit Writer(std::ostream &os) : os_(os) {}
+            ~Writer() { flush(); }
+
+            void flush()
+            {
+                if (len_ > 0)
+                    os_.write(buf_, len_);
+                len_ = 0;
+            }
+
+            void putByte(uint8_t b)
+            {
+                if (len_ == sizeof(buf_))
+                    flush();
+                buf_[len_++] = static_cast<char>(b);
+            }
+
+            void putVarint(uint64_t v)
+            {
+                while (v >= 0x80)
+                {
+                    putByte(static_cast<uint8_t>(v) | 0x80);
+                    v >>= 7;
+                }
+                putByte(static_cast<uint8_t>(v));
+            }
+
+            void putSigned(int64_t v)
+            {
+                putVarint((static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63));
+            }
+
+            template <class Bits>
+            void putBits(Bits v, int bytes)
+            {
+                for (int i = 0; i < bytes; i++)
+                {
+                    putByte(static_cast<uint8_t>(v));
+                    v >>= 8;
+                }
+            }
+        };
+
+        // メモリ上のバイト列から読み出す。範囲外を読もうとするとfailed()になる
+        class Reader
+        {
+        private:
+            const uint8_t *p_;
+            const uint8_t *end_;
+            bool failed_ = false;
+
+        public:
+            Reader(const uint8_t *data, size_t size) : p_(data), end_(data + size) {}
+
+            bool failed() const { return failed_; }
+            bool atEnd() const { return p_ == end_; }
+
+            uint8_t getByte()
+            {
+                if (p_ == end_)
+                {
+                    failed_ = true;
+                    return 0;
+                }
+                return *p_++;
+            }
+
+            uint64_t getVarint()
+            {
+                uint64_t v = 0;
+                for (int shift = 0; shift < 64; shift += 7)
+                {
+                    uint8_t b = getByte();
+                    v |= static_cast<uint64_t>(b & 0x7f) << shift;
+                    if ((b & 0x80) == 0)
+                        return v;
+                }
+                failed_ = true;
+                return 0;
+            }
+
+            int64_t getSigned()
+            {
+                uint64_t v = getVarint();
+                return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+            }
+
+            template <class Bits>
+            Bits getBits(int bytes)
+            {
+                Bits v = 0;
+                for (int i = 0; i < bytes; i++)
+                    v |= static_cast<Bits>(getByte()) << (i * 8);
+                return v;
+            }
+        };
+
+        template <class BitState>
+        uint64_t legalMask(const BitState &state)
+        {
+            uint64_t mask = 0;
+            for (const auto action : state.legalActions())
+                mask |= 1ULL << action;
+            return mask;
+        }
+
+        template <class BitState>
+        void writeNode(Writer *writer, const BasicNode<BitState> &node)
+        {
+            writer->putVarint(static_cast<uint64_t>(node.n_));
+            writer->putSigned(static_cast<int64_t>(std::llround(node.getW() * W_SCALE)));
+            if (node.child_nodes_.empty())
+            {
+                writer->putVarint(0);
+                return;
+            }
+            uint64_t mask = 0;
+            for (const auto &child : node.child_nodes_)
+                mask |= 1ULL << child.getAction();
+            writer->putVarint(mask);
+            for (const auto &child : node.child_nodes_)
+                writeNode(writer, child);
+        }
+
+        // ヘッダを読み、根の盤面を返す
+        template <class BitState>
+        bool readHeader(Reader *reader, BitState *root_state)
+        {
+            using Bits = typename BitState::Bits;
+            constexpr int bytes = boardBytes(BitState::Geometry::BITS);
+            for (int i = 0; i < 4; i++)
+            {
+                if (reader->getByte() != static_cast<uint8_t>(MAGIC[i]))
+                    return false;
+            }
+            const uint8_t version = reader->getByte();
+            if (version < MIN_VERSION || version > VERSION || reader->getByte() != BitState::H || reader->getByte() != BitState::W)
+                return false;
+            bool is_first = reader->getByte() != 0;
+            Bits my_board = reader->getBits<Bits>(bytes);
+            Bits all_board = reader->getBits<Bits>(bytes);
+            if (reader->failed() || (my_board & ~all_board) != 0 || (all_board & ~BitState::Geometry::FILLED_BOARD_BITS) != 0)
+                return false;
+            *root_state = BitState::fromBoards(my_board, all_board, is_first);
+            return true;
+        }
+
+        // 1ノード分を読み、node(nullptrなら読み飛ばす)に復元する
+        template <class BitState>
+        bool readNode(Reader *reader, const BitState &state, BasicNode<BitState> *node, BasicSearchContext<BitState> *ctx, int depth)
+        {
+            if (depth > MAX_DEPTH)
+                return false;
+            double n = static_cast<double>(reader->getVarint());
+            double w = static_cast<double>(reader->getSigned()) / W_SCALE;
+            uint64_t mask = reader->getVarint();
+            if (reader->failed())
+                return false;
+            if (node != nullptr)
+                node->setStats(w, n);
+            if (mask == 0)
+                return true;
+            if (state.isDone() || (mask & ~legalMask(state)) != 0)
+                return false;
+
+            if (node != nullptr)
+            {
+                node->expand(ctx);
+                if (!node->isExpanded())
+                    node = nullptr; // ノード数の上限に達したので以降の部分木は読み飛ばす
+            }
+            for (int action = 0; action < BitState::W; action++)
+            {
+                if ((mask & (1ULL << action)) == 0)
+                    continue;
+                BitState child_state = state;
+                child_state.advance(action);
+                BasicNode<BitState> *child = node != nullptr ? node->expandAction(action, ctx) : nullptr;
+                if (!readNode(reader, child_state, child, ctx, depth + 1))
+                    return false;
+            }
+            return true;
+        }
+    }
+
+    // 探索木をストリームに書き出す
+    template <class BitState>
+    bool writeTree(std::ostream &os, const BasicNode<BitState> &root)
+    {
+        constexpr int bytes = tree_io::boardBytes(BitState::Geometry::BITS);
+        {
+            tree_io::Writer writer(os);
+            for (const char c : tree_io::MAGIC)
+                writer.putByte(static_cast<uint8_t>(c));
+            writer.putByte(tree_io::VERSION);
+            writer.putByte(BitState::H);
+            writer.putByte(BitState::W);
+            const BitState &state = root.getState();
+            writer.putByte(state.isFirst() ? 1 : 0);
+            writer.putBits(state.getMyBoard(), bytes);
+            writer.putBits(state.getAllBoard(), bytes);
+            tree_io::writeNode(&writer, root);
+        }
+        return os.good();
+    }
+
+    template <class BitState>
+    bool writeTree(const char *path, const BasicNode<BitState> &root)
+    {
+        std::ofstream ofs(path, std::ios::binary);
+        return ofs && writeTree(ofs, root);
+    }
+
+    // バイト列から探索木を復元する。rootは読み込んだ根の盤面で置き換えられる
+    template <class BitState>
+    bool readTree(const uint8_t *data, size_t size, BasicNode<BitState> *root, BasicSearchContext<BitState> *ctx = nullptr)
+    {
+        tree_io::Reader reader(data, size);
+        BitState state;
+        if (!tree_io::readHeader(&reader, &state))
+            return false;
+        if (ctx != nullptr && ctx->pool != nullptr)
+            ctx->pool->release(&root->child_nodes_);
+        *root = BasicNode<BitState>(state);
+        return tree_io::readNode(&reader, state, root, ctx, 0) && reader.atEnd();
+    }
+
+    template <class BitState>
+    bool readTree(const char *path, BasicNode<BitState> *root, BasicSearchContext<BitState> *ctx = nullptr)
+    {
+        std::ifstream ifs(path, std::ios::binary);
+        if (!ifs)
+            return false;
+        std::vector<uint8_t> data((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+        return readTree(data.data(), data.size(), root, ctx);
+    }
+
+#if defined(__unix__) || defined(__APPLE__)
+    // ファイルを読み込み専用でメモリにマップする
+    class MappedFile
+    {
+    private:
+        const uint8_t *data_ = nullptr;
+        size_t size_ = 0;
+
+    public:
+        MappedFile() {}
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+        ~MappedFile() { close(); }
+
+        bool open(const char *path)
+        {
+            close();
+            int fd = ::open(path, O_RDONLY);
+            if (fd < 0)
+                return false;
+            struct stat st;
+            if (fstat(fd, &st) != 0 || st.st_size == 0)
+            {
+                ::close(fd);
+                return false;
+            }
+            void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if (p == MAP_FAILED)
+                return false;
+            data_ = static_cast<const uint8_t *>(p);
+            size_ = st.st_size;
+            return true;
+        }
+
+        void close()
+        {
+            if (data_ != nullptr)
+                munmap(const_cast<uint8_t *>(data_), size_);
+            data_ = nullptr;
+            size_ = 0;
+        }
+
+        const uint8_t *data() const { return data_; }
+        size_t size() const { return size_; }
+    };
+#else
+    // mmapのない環境では、ファイル全体をメモリに読み込んで同じように使えるようにする
+    class MappedFile
+    {
+    private:
+        std::vector<uint8_t> bytes_;
+
+    public:
+        MappedFile() {}
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+
+        bool open(const char *path)
+        {
+            close();
+            std::ifstream ifs(path, std::ios::binary);
+            if (!ifs)
+                return false;
+            bytes_.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+            return !bytes_.empty();
+        }
+
+        void close() { bytes_.clear(); }
+
+        const uint8_t *data() const { return bytes_.empty() ? nullptr : bytes_.data(); }
+        size_t size() const { return bytes_.size(); }
+    };
+#endif
+
+    // 保存した探索木をノードを作らずに走査する読み込み専用のビュー
+    template <class BitState>
+    class BasicTreeView
+    {
+    private:
+        const uint8_t *data_;
+        size_t size_;
+        BitState root_state_;
+        bool valid_;
+
+        // visitorがfalseを返したノードの子孫は盤面を求めずに読み飛ばす
+        template <class Visitor>
+        bool visit(tree_io::Reader *reader, const BitState &state, int depth, int action, bool report, Visitor &visitor) const
+        {
+            if (depth > tree_io::MAX_DEPTH)
+                return false;
+            double n = static_cast<double>(reader->getVarint());
+            double w = static_cast<double>(reader->getSigned()) / tree_io::W_SCALE;
+            uint64_t mask = reader->getVarint();
+            if (reader->failed())
+                return false;
+            if (report)
+            {
+                report = visitor(depth, action, state, n, w);
+                if (mask != 0 && (state.isDone() || (mask & ~tree_io::legalMask(state)) != 0))
+                    return false;
+            }
+            for (int next = 0; next < BitState::W; next++)
+            {
+                if ((mask & (1ULL << next)) == 0)
+                    continue;
+                BitState child_state = state;
+                if (report)
+                    child_state.advance(next);
+                if (!visit(reader, child_state, depth + 1, next, report, visitor))
+                    return false;
+            }
+            return true;
+        }
+
+    public:
+        BasicTreeView(const uint8_t *data, size_t size) : data_(data), size_(size)
+        {
+            tree_io::Reader reader(data, size);
+            valid_ = tree_io::readHeader(&reader, &root_state_);
+        }
+
+        bool isValid() const { return valid_; }
+        const BitState &getRootState() const { return root_state_; }
+
+        // 行きがけ順に visitor(depth, action, state, n, w) を呼ぶ。根のactionは-1
+        template <class Visitor>
+        bool forEach(Visitor visitor) const
+        {
+            if (!valid_)
+                return false;
+            tree_io::Reader reader(data_, size_);
+            BitState state;
+            tree_io::readHeader(&reader, &state);
+            return visit(&reader, state, 0, -1, true, visitor) && reader.atEnd();
+        }
+    };
+
+    using TreeView = BasicTreeView<ConnectFourStateByBitSet>;
+}